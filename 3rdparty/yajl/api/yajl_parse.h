@@ -156,7 +156,16 @@ extern "C" {
          * yajl will enter an error state (premature EOF).  Setting this
          * flag suppresses that check and the corresponding error.
          */
-        yajl_allow_partial_values = 0x10
+        yajl_allow_partial_values = 0x10,
+        /**
+         * Strings, and map keys, are unescaped inside the text passed to
+         * yajl_parse() and NUL terminated over their closing quote, and
+         * the callbacks are handed pointers into that text.  The text is
+         * modified, so it must be writable.  A string split between two
+         * yajl_parse() calls is still decoded into the parser's own
+         * buffer.
+         */
+        yajl_decode_in_place = 0x20
     } yajl_option;
 
     /** allow the modification of parser options subsequent to handle
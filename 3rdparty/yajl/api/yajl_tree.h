@@ -54,6 +54,9 @@ typedef enum {
 
 #define YAJL_NUMBER_INT_VALID    0x01
 #define YAJL_NUMBER_DOUBLE_VALID 0x02
+/** Set once \em i, \em d and the two flags above have been filled in. Numbers
+ * are only converted when first read through the macros below. */
+#define YAJL_NUMBER_PARSED       0x04
 
 /** A pointer to a node in the parse tree */
 typedef struct yajl_val_s * yajl_val;
@@ -79,9 +82,10 @@ struct yajl_val_s
             long long i; /*< integer value, if representable. */
             double  d;   /*< double value, if representable. */
             char   *r;   /*< unparsed number in string form. */
+            size_t len;  /*< length of \em r. */
             /** Signals whether the \em i and \em d members are
-             * valid. See \c YAJL_NUMBER_INT_VALID and
-             * \c YAJL_NUMBER_DOUBLE_VALID. */
+             * valid. See \c YAJL_NUMBER_INT_VALID,
+             * \c YAJL_NUMBER_DOUBLE_VALID and \c YAJL_NUMBER_PARSED. */
             unsigned int flags;
         } number;
         struct {
@@ -121,6 +125,27 @@ struct yajl_val_s
 YAJL_API yajl_val yajl_tree_parse (const char *input,
                                    char *error_buffer, size_t error_buffer_size);
 
+/**
+ * Parse a string like "yajl_tree_parse", taking every allocation, both the
+ * parser's and the tree's, from \em afs. Passing NULL uses malloc. A tree
+ * parsed this way must be freed with "yajl_tree_free_alloc" and the same
+ * \em afs, or by releasing the allocator's memory as a whole.
+ */
+YAJL_API yajl_val yajl_tree_parse_alloc (const char *input,
+                                         yajl_alloc_funcs *afs,
+                                         char *error_buffer, size_t error_buffer_size);
+
+/**
+ * Parse \em length bytes of \em input like "yajl_tree_parse_alloc", but
+ * destructively. Strings and keys are unescaped inside \em input and the
+ * tree points at them there rather than holding copies, so \em input must
+ * outlive the tree. Such a tree can only be freed by releasing the
+ * allocator's memory as a whole.
+ */
+YAJL_API yajl_val yajl_tree_parse_in_place (char *input, size_t length,
+                                            yajl_alloc_funcs *afs,
+                                            char *error_buffer, size_t error_buffer_size);
+
 
 /**
  * Free a parse tree returned by "yajl_tree_parse".
@@ -130,6 +155,11 @@ YAJL_API yajl_val yajl_tree_parse (const char *input,
  */
 YAJL_API void yajl_tree_free (yajl_val v);
 
+/**
+ * Free a parse tree returned by "yajl_tree_parse_alloc".
+ */
+YAJL_API void yajl_tree_free_alloc (yajl_val v, yajl_alloc_funcs *afs);
+
 /**
  * Access a nested value inside a tree.
  *
@@ -146,11 +176,24 @@ YAJL_API void yajl_tree_free (yajl_val v);
  */
 YAJL_API yajl_val yajl_tree_get(yajl_val parent, const char ** path, yajl_type type);
 
+/**
+ * Convert a number to integer and double on first use, and return its flags.
+ * The "YAJL_IS_INTEGER", "YAJL_IS_DOUBLE" and "YAJL_GET_*" macros call it.
+ */
+YAJL_API unsigned int yajl_tree_number_flags(yajl_val v);
+
+/**
+ * The NUL terminated text of a number. In a tree parsed in place it points
+ * into the input, and the terminator is written over the byte following the
+ * number on first use.
+ */
+YAJL_API char * yajl_tree_number_string(yajl_val v);
+
 /* Various convenience macros to check the type of a `yajl_val` */
 #define YAJL_IS_STRING(v) (((v) != NULL) && ((v)->type == yajl_t_string))
 #define YAJL_IS_NUMBER(v) (((v) != NULL) && ((v)->type == yajl_t_number))
-#define YAJL_IS_INTEGER(v) (YAJL_IS_NUMBER(v) && ((v)->u.number.flags & YAJL_NUMBER_INT_VALID))
-#define YAJL_IS_DOUBLE(v) (YAJL_IS_NUMBER(v) && ((v)->u.number.flags & YAJL_NUMBER_DOUBLE_VALID))
+#define YAJL_IS_INTEGER(v) (YAJL_IS_NUMBER(v) && (yajl_tree_number_flags(v) & YAJL_NUMBER_INT_VALID))
+#define YAJL_IS_DOUBLE(v) (YAJL_IS_NUMBER(v) && (yajl_tree_number_flags(v) & YAJL_NUMBER_DOUBLE_VALID))
 #define YAJL_IS_OBJECT(v) (((v) != NULL) && ((v)->type == yajl_t_object))
 #define YAJL_IS_ARRAY(v)  (((v) != NULL) && ((v)->type == yajl_t_array ))
 #define YAJL_IS_TRUE(v)   (((v) != NULL) && ((v)->type == yajl_t_true  ))
@@ -163,15 +206,15 @@ YAJL_API yajl_val yajl_tree_get(yajl_val parent, const char ** path, yajl_type t
 
 /** Get the string representation of a number.  You should check type first,
  *  perhaps using YAJL_IS_NUMBER */
-#define YAJL_GET_NUMBER(v) ((v)->u.number.r)
+#define YAJL_GET_NUMBER(v) (yajl_tree_number_string(v))
 
 /** Get the double representation of a number.  You should check type first,
  *  perhaps using YAJL_IS_DOUBLE */
-#define YAJL_GET_DOUBLE(v) ((v)->u.number.d)
+#define YAJL_GET_DOUBLE(v) (yajl_tree_number_flags(v), (v)->u.number.d)
 
 /** Get the 64bit (long long) integer representation of a number.  You should
  *  check type first, perhaps using YAJL_IS_INTEGER */
-#define YAJL_GET_INTEGER(v) ((v)->u.number.i)
+#define YAJL_GET_INTEGER(v) (yajl_tree_number_flags(v), (v)->u.number.i)
 
 /** Get a pointer to a yajl_val_object or NULL if the value is not an object. */
 #define YAJL_GET_OBJECT(v) (YAJL_IS_OBJECT(v) ? &(v)->u.object : NULL)
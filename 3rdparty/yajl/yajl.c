@@ -91,6 +91,7 @@ yajl_config(yajl_handle h, yajl_option opt, ...)
         case yajl_allow_trailing_garbage:
         case yajl_allow_multiple_values:
         case yajl_allow_partial_values:
+        case yajl_decode_in_place:
             if (va_arg(ap, int)) h->flags |= opt;
             else h->flags &= ~opt;
             break;
@@ -79,6 +79,19 @@ void yajl_buf_append(yajl_buf buf, const void * data, size_t len)
     }
 }
 
+unsigned char * yajl_buf_reserve(yajl_buf buf, size_t len)
+{
+    yajl_buf_ensure_available(buf, len);
+    return buf->data + buf->used;
+}
+
+void yajl_buf_commit(yajl_buf buf, size_t len)
+{
+    assert(buf->used + len < buf->len);
+    buf->used += len;
+    buf->data[buf->used] = 0;
+}
+
 void yajl_buf_clear(yajl_buf buf)
 {
     buf->used = 0;
@@ -42,6 +42,13 @@ void yajl_buf_free(yajl_buf buf);
 /* append a number of bytes to the buffer */
 void yajl_buf_append(yajl_buf buf, const void * data, size_t len);
 
+/* make room for len more bytes and return where they go.  nothing is
+ * added until yajl_buf_commit is called with the count written */
+unsigned char * yajl_buf_reserve(yajl_buf buf, size_t len);
+
+/* add len bytes written after a yajl_buf_reserve */
+void yajl_buf_commit(yajl_buf buf, size_t len);
+
 /* empty the buffer */
 void yajl_buf_clear(yajl_buf buf);
 
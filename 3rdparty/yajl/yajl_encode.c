@@ -21,6 +21,19 @@
 #include <string.h>
 #include <stdio.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define YAJL_ENCODE_NEON 1
+#endif
+
+/* SSSE3 is picked at runtime, since x86 builds only assume SSE2 */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define YAJL_ENCODE_SSSE3 1
+#endif
+
 static void CharToHex(unsigned char c, char * hexBuf)
 {
     const char * hexchar = "0123456789ABCDEF";
@@ -28,6 +41,141 @@ static void CharToHex(unsigned char c, char * hexBuf)
     hexBuf[1] = hexchar[c & 0x0F];
 }
 
+/* offset of the first byte of str that has to be escaped, or len.  that is
+ * quotes, backslashes, control chars and optionally the solidus, found
+ * sixteen bytes at a time with SSE2 or NEON. */
+static size_t
+yajl_string_escape_scan(const unsigned char * str, size_t len,
+                        int escape_solidus)
+{
+    size_t off = 0;
+
+#if defined(__SSE2__)
+    {
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i solidus = _mm_set1_epi8(escape_solidus ? '/' : '"');
+        const __m128i control = _mm_set1_epi8(0x1f);
+        while (off + 16 <= len) {
+            __m128i chunk = _mm_loadu_si128((const __m128i *) (str + off));
+            __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                        _mm_cmpeq_epi8(chunk, backslash));
+            unsigned int found;
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, solidus));
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(
+                       _mm_max_epu8(chunk, control), control));
+            found = (unsigned int) _mm_movemask_epi8(hits);
+            if (found) return off + __builtin_ctz(found);
+            off += 16;
+        }
+    }
+#elif defined(YAJL_ENCODE_NEON)
+    {
+        const uint8x16_t quote = vdupq_n_u8('"');
+        const uint8x16_t backslash = vdupq_n_u8('\\');
+        const uint8x16_t solidus = vdupq_n_u8(escape_solidus ? '/' : '"');
+        const uint8x16_t space = vdupq_n_u8(0x20);
+        while (off + 16 <= len) {
+            uint8x16_t chunk = vld1q_u8(str + off);
+            uint8x16_t hits = vorrq_u8(vceqq_u8(chunk, quote),
+                                       vceqq_u8(chunk, backslash));
+            uint8x8_t folded;
+            hits = vorrq_u8(hits, vceqq_u8(chunk, solidus));
+            hits = vorrq_u8(hits, vcltq_u8(chunk, space));
+            folded = vorr_u8(vget_low_u8(hits), vget_high_u8(hits));
+            /* the byte by byte loop below finds it within the block */
+            if (vget_lane_u64(vreinterpret_u64_u8(folded), 0)) break;
+            off += 16;
+        }
+    }
+#endif
+
+    while (off < len) {
+        unsigned char c = str[off];
+        if (c < 0x20 || c == '"' || c == '\\' || (c == '/' && escape_solidus))
+            break;
+        off++;
+    }
+    return off;
+}
+
+/* write the escape for c, which yajl_string_escape_scan stopped at, and
+ * return its length.  out needs room for six bytes. */
+static size_t
+yajl_escape_char(unsigned char c, unsigned char * out)
+{
+    char escaped = 0;
+    switch (c) {
+        case '\r': escaped = 'r'; break;
+        case '\n': escaped = 'n'; break;
+        case '\\': escaped = '\\'; break;
+        /* it is not required to escape a solidus in JSON:
+         * read sec. 2.5: http://www.ietf.org/rfc/rfc4627.txt
+         * specifically, this production from the grammar:
+         *   unescaped = %x20-21 / %x23-5B / %x5D-10FFFF
+         */
+        case '/': escaped = '/'; break;
+        case '"': escaped = '"'; break;
+        case '\f': escaped = 'f'; break;
+        case '\b': escaped = 'b'; break;
+        case '\t': escaped = 't'; break;
+    }
+    out[0] = '\\';
+    if (escaped) {
+        out[1] = (unsigned char) escaped;
+        return 2;
+    }
+    out[1] = 'u'; out[2] = '0'; out[3] = '0';
+    CharToHex(c, (char *) out + 4);
+    return 6;
+}
+
+size_t
+yajl_string_escaped_length(const unsigned char * str, size_t len,
+                           int escape_solidus)
+{
+    size_t total = len;
+    size_t end = yajl_string_escape_scan(str, len, escape_solidus);
+
+    while (end < len) {
+        unsigned char c = str[end];
+        switch (c) {
+            case '\r': case '\n': case '\\': case '/': case '"':
+            case '\f': case '\b': case '\t':
+                total += 1;
+                break;
+            default:
+                total += 5;
+        }
+        end++;
+        end += yajl_string_escape_scan(str + end, len - end, escape_solidus);
+    }
+    return total;
+}
+
+size_t
+yajl_string_escape(unsigned char * out, const unsigned char * str,
+                   size_t len, int escape_solidus)
+{
+    unsigned char * start = out;
+    size_t end = 0;
+
+    while (end < len) {
+        size_t run = yajl_string_escape_scan(str + end, len - end,
+                                             escape_solidus);
+        memcpy(out, str + end, run);
+        out += run;
+        end += run;
+        if (end == len) break;
+        out += yajl_escape_char(str[end++], out);
+    }
+    return (size_t) (out - start);
+}
+
+/* escaped output is gathered here so a print callback sees a few large
+ * pieces rather than two calls per escape. */
+#define YAJL_ENCODE_CHUNK 1024
+
 void
 yajl_string_encode(const yajl_print_t print,
                    void * ctx,
@@ -35,44 +183,30 @@ yajl_string_encode(const yajl_print_t print,
                    size_t len,
                    int escape_solidus)
 {
-    size_t beg = 0;
+    unsigned char out[YAJL_ENCODE_CHUNK];
+    size_t used = 0;
     size_t end = 0;
-    char hexBuf[7];
-    hexBuf[0] = '\\'; hexBuf[1] = 'u'; hexBuf[2] = '0'; hexBuf[3] = '0';
-    hexBuf[6] = 0;
 
     while (end < len) {
-        const char * escaped = NULL;
-        switch (str[end]) {
-            case '\r': escaped = "\\r"; break;
-            case '\n': escaped = "\\n"; break;
-            case '\\': escaped = "\\\\"; break;
-            /* it is not required to escape a solidus in JSON:
-             * read sec. 2.5: http://www.ietf.org/rfc/rfc4627.txt
-             * specifically, this production from the grammar:
-             *   unescaped = %x20-21 / %x23-5B / %x5D-10FFFF
-             */
-            case '/': if (escape_solidus) escaped = "\\/"; break;
-            case '"': escaped = "\\\""; break;
-            case '\f': escaped = "\\f"; break;
-            case '\b': escaped = "\\b"; break;
-            case '\t': escaped = "\\t"; break;
-            default:
-                if ((unsigned char) str[end] < 32) {
-                    CharToHex(str[end], hexBuf + 4);
-                    escaped = hexBuf;
-                }
-                break;
-        }
-        if (escaped != NULL) {
-            print(ctx, (const char *) (str + beg), end - beg);
-            print(ctx, escaped, (unsigned int)strlen(escaped));
-            beg = ++end;
-        } else {
-            ++end;
+        size_t run = yajl_string_escape_scan(str + end, len - end,
+                                             escape_solidus);
+        if (used + run + 6 > sizeof(out)) {
+            if (used) print(ctx, (const char *) out, used);
+            used = 0;
+            /* long runs go straight out without the copy */
+            if (run + 6 > sizeof(out)) {
+                print(ctx, (const char *) (str + end), run);
+                end += run;
+                run = 0;
+            }
         }
+        memcpy(out + used, str + end, run);
+        used += run;
+        end += run;
+        if (end == len) break;
+        used += yajl_escape_char(str[end++], out + used);
     }
-    print(ctx, (const char *) (str + beg), end - beg);
+    if (used) print(ctx, (const char *) out, used);
 }
 
 static void hexToDigit(unsigned int * val, const unsigned char * hex)
@@ -113,108 +247,360 @@ static void Utf32toUtf8(unsigned int codepoint, char * utf8Buf)
     }
 }
 
-void yajl_string_decode(yajl_buf buf, const unsigned char * str,
-                        size_t len)
+/* no escape sequence decodes to more bytes than it occupies, so the output
+ * fits in length bytes and never overtakes the input.  the runs between
+ * escapes are found with memchr and copied whole. */
+size_t yajl_string_unescape(unsigned char * out, const unsigned char * str,
+                            size_t len)
 {
-    size_t beg = 0;
-    size_t end = 0;    
+    unsigned char * start = out;
+    size_t end = 0;
 
     while (end < len) {
-        if (str[end] == '\\') {
-            char utf8Buf[5];
-            const char * unescaped = "?";
-            yajl_buf_append(buf, str + beg, end - beg);
-            switch (str[++end]) {
-                case 'r': unescaped = "\r"; break;
-                case 'n': unescaped = "\n"; break;
-                case '\\': unescaped = "\\"; break;
-                case '/': unescaped = "/"; break;
-                case '"': unescaped = "\""; break;
-                case 'f': unescaped = "\f"; break;
-                case 'b': unescaped = "\b"; break;
-                case 't': unescaped = "\t"; break;
-                case 'u': {
-                    unsigned int codepoint = 0;
-                    hexToDigit(&codepoint, str + ++end);
-                    end+=3;
-                    /* check if this is a surrogate */
-                    if ((codepoint & 0xFC00) == 0xD800) {
-                        end++;
-                        if (str[end] == '\\' && str[end + 1] == 'u') {
-                            unsigned int surrogate = 0;
-                            hexToDigit(&surrogate, str + end + 2);
-                            codepoint =
-                                (((codepoint & 0x3F) << 10) | 
-                                 ((((codepoint >> 6) & 0xF) + 1) << 16) | 
-                                 (surrogate & 0x3FF));
-                            end += 5;
-                        } else {
-                            unescaped = "?";
-                            break;
-                        }
-                    }
-                    
-                    Utf32toUtf8(codepoint, utf8Buf);
-                    unescaped = utf8Buf;
-
-                    if (codepoint == 0) {
-                        yajl_buf_append(buf, unescaped, 1);
-                        beg = ++end;
-                        continue;
-                    }
+        const unsigned char * escape =
+            (const unsigned char *) memchr(str + end, '\\', len - end);
+        size_t run = (escape ? (size_t) (escape - str) : len) - end;
 
-                    break;
+        if (out != str + end) memmove(out, str + end, run);
+        out += run;
+        end += run;
+        if (!escape) break;
+
+        switch (str[++end]) {
+            case 'r': *out++ = '\r'; break;
+            case 'n': *out++ = '\n'; break;
+            case '\\': *out++ = '\\'; break;
+            case '/': *out++ = '/'; break;
+            case '"': *out++ = '"'; break;
+            case 'f': *out++ = '\f'; break;
+            case 'b': *out++ = '\b'; break;
+            case 't': *out++ = '\t'; break;
+            case 'u': {
+                char utf8Buf[5];
+                unsigned int codepoint = 0;
+                hexToDigit(&codepoint, str + ++end);
+                end+=3;
+                /* check if this is a surrogate */
+                if ((codepoint & 0xFC00) == 0xD800) {
+                    end++;
+                    if (str[end] == '\\' && str[end + 1] == 'u') {
+                        unsigned int surrogate = 0;
+                        hexToDigit(&surrogate, str + end + 2);
+                        codepoint =
+                            (((codepoint & 0x3F) << 10) | 
+                             ((((codepoint >> 6) & 0xF) + 1) << 16) | 
+                             (surrogate & 0x3FF));
+                        end += 5;
+                    } else {
+                        /* a lone surrogate, leave what follows it alone */
+                        *out++ = '?';
+                        end--;
+                        break;
+                    }
+                }
+                
+                Utf32toUtf8(codepoint, utf8Buf);
+                if (codepoint == 0) {
+                    *out++ = 0;
+                } else {
+                    size_t n = strlen(utf8Buf);
+                    memcpy(out, utf8Buf, n);
+                    out += n;
                 }
-                default:
-                    assert("this should never happen" == NULL);
+                break;
             }
-            yajl_buf_append(buf, unescaped, (unsigned int)strlen(unescaped));
-            beg = ++end;
-        } else {
-            end++;
+            default:
+                assert("this should never happen" == NULL);
+        }
+        end++;
+    }
+    return (size_t) (out - start);
+}
+
+void yajl_string_decode(yajl_buf buf, const unsigned char * str,
+                        size_t len)
+{
+    unsigned char * out = yajl_buf_reserve(buf, len);
+    yajl_buf_commit(buf, yajl_string_unescape(out, str, len));
+}
+
+/* utf8 validation.  ascii is skipped sixteen bytes at a time, thirty two
+ * with AVX2.  from the first byte with the high bit set, the rest is checked
+ * a block at a time with the lookup tables of Keiser and Lemire on SSSE3 or
+ * NEON, or a sequence at a time otherwise.  all of them reject overlong
+ * forms, surrogates and code points past U+10FFFF. */
+
+/* the length of the valid sequence at s, or 0 */
+static size_t
+yajl_utf8_sequence(const unsigned char * s, size_t len)
+{
+    unsigned char lo = 0x80, hi = 0xBF;
+    size_t need, i;
+
+    if (s[0] < 0x80) return 1;
+    if (s[0] < 0xC2 || s[0] > 0xF4) return 0;
+    if (s[0] < 0xE0) {
+        need = 2;
+    } else if (s[0] < 0xF0) {
+        need = 3;
+        if (s[0] == 0xE0) lo = 0xA0;
+        else if (s[0] == 0xED) hi = 0x9F;
+    } else {
+        need = 4;
+        if (s[0] == 0xF0) lo = 0x90;
+        else if (s[0] == 0xF4) hi = 0x8F;
+    }
+    if (len < need || s[1] < lo || s[1] > hi) return 0;
+    for (i = 2; i < need; i++) {
+        if ((s[i] & 0xC0) != 0x80) return 0;
+    }
+    return need;
+}
+
+static int
+yajl_utf8_validate_scalar(const unsigned char * s, size_t len)
+{
+    size_t off = 0;
+
+    while (off < len) {
+        size_t n = 1;
+        if (s[off] >= 0x80) {
+            n = yajl_utf8_sequence(s + off, len - off);
+            if (!n) return 0;
         }
+        off += n;
     }
-    yajl_buf_append(buf, str + beg, end - beg);
+    return 1;
 }
 
-#define ADV_PTR s++; if (!(len--)) return 0;
+#if defined(YAJL_ENCODE_SSSE3) || defined(YAJL_ENCODE_NEON)
+/* each pair of bytes is looked up by the high nibble of the first, its low
+ * nibble and the high nibble of the second.  a bit set in all three is an
+ * error, except that two continuation bytes are fine where a three or four
+ * byte lead came two or three bytes earlier. */
+#define UTF8_TOO_SHORT  0x01 /* lead then no continuation */
+#define UTF8_TOO_LONG   0x02 /* ascii then continuation */
+#define UTF8_OVERLONG_3 0x04 /* E0 80..9F */
+#define UTF8_TOO_LARGE  0x08 /* F4 90..BF, F5.. 90..BF */
+#define UTF8_SURROGATE  0x10 /* ED A0..BF */
+#define UTF8_OVERLONG_2 0x20 /* C0..C1 */
+#define UTF8_TOO_LARGE_1000 0x40 /* F5.. 80..8F */
+#define UTF8_OVERLONG_4 0x40 /* F0 80..8F */
+#define UTF8_TWO_CONTS  0x80 /* continuation then continuation */
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
 
-int yajl_string_validate_utf8(const unsigned char * s, size_t len)
+static const unsigned char utf8FirstHigh[16] = {
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+    UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+    UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+    UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4
+};
+
+static const unsigned char utf8FirstLow[16] = {
+    UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+    UTF8_CARRY | UTF8_OVERLONG_2,
+    UTF8_CARRY,
+    UTF8_CARRY,
+    UTF8_CARRY | UTF8_TOO_LARGE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000
+};
+
+static const unsigned char utf8SecondHigh[16] = {
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+        UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+        UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+        UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+        UTF8_TOO_LARGE,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT
+};
+
+/* bytes past which a block's last three bytes start an unfinished sequence */
+static const unsigned char utf8Incomplete[16] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1
+};
+#endif
+
+#if defined(YAJL_ENCODE_SSSE3)
+__attribute__((target("ssse3")))
+static int
+yajl_utf8_validate_ssse3(const unsigned char * s, size_t len)
 {
-    if (!len) return 1;
-    if (!s) return 0;
-    
-    while (len--) {
-        /* single byte */
-        if (*s <= 0x7f) {
-            /* noop */
+    const __m128i firstHigh = _mm_loadu_si128((const __m128i *) utf8FirstHigh);
+    const __m128i firstLow = _mm_loadu_si128((const __m128i *) utf8FirstLow);
+    const __m128i secondHigh =
+        _mm_loadu_si128((const __m128i *) utf8SecondHigh);
+    const __m128i incomplete =
+        _mm_loadu_si128((const __m128i *) utf8Incomplete);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i third = _mm_set1_epi8(0xE0 - 0x80);
+    const __m128i fourth = _mm_set1_epi8(0xF0 - 0x80);
+    const __m128i high = _mm_set1_epi8(-0x80);
+    __m128i prev = _mm_setzero_si128();
+    __m128i prevIncomplete = _mm_setzero_si128();
+    __m128i error = _mm_setzero_si128();
+    unsigned char tail[16];
+    size_t off;
+
+    for (off = 0; off < len; off += 16) {
+        __m128i chunk;
+        if (off + 16 <= len) {
+            chunk = _mm_loadu_si128((const __m128i *) (s + off));
+        } else {
+            /* zeros are ascii, so a sequence cut short shows as too short */
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, s + off, len - off);
+            chunk = _mm_loadu_si128((const __m128i *) tail);
         }
-        /* two byte */ 
-        else if ((*s >> 5) == 0x6) {
-            ADV_PTR;
-            if (!((*s >> 6) == 0x2)) return 0;
+        if (!_mm_movemask_epi8(chunk)) {
+            error = _mm_or_si128(error, prevIncomplete);
+        } else {
+            __m128i prev1 = _mm_alignr_epi8(chunk, prev, 15);
+            __m128i special = _mm_and_si128(
+                _mm_and_si128(
+                    _mm_shuffle_epi8(firstHigh, _mm_and_si128(
+                        _mm_srli_epi16(prev1, 4), nibble)),
+                    _mm_shuffle_epi8(firstLow, _mm_and_si128(prev1, nibble))),
+                _mm_shuffle_epi8(secondHigh, _mm_and_si128(
+                    _mm_srli_epi16(chunk, 4), nibble)));
+            __m128i continued = _mm_or_si128(
+                _mm_subs_epu8(_mm_alignr_epi8(chunk, prev, 14), third),
+                _mm_subs_epu8(_mm_alignr_epi8(chunk, prev, 13), fourth));
+            error = _mm_or_si128(error, _mm_xor_si128(
+                        _mm_and_si128(continued, high), special));
+            prevIncomplete = _mm_subs_epu8(chunk, incomplete);
         }
-        /* three byte */
-        else if ((*s >> 4) == 0x0e) {
-            ADV_PTR;
-            if (!((*s >> 6) == 0x2)) return 0;
-            ADV_PTR;
-            if (!((*s >> 6) == 0x2)) return 0;
+        prev = chunk;
+    }
+    error = _mm_or_si128(error, prevIncomplete);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128()))
+        == 0xFFFF;
+}
+#elif defined(YAJL_ENCODE_NEON)
+/* sixteen entry lookup with ARMv7's eight byte table instructions */
+static uint8x16_t
+yajl_utf8_lookup(uint8x8x2_t table, uint8x16_t index)
+{
+    return vcombine_u8(vtbl2_u8(table, vget_low_u8(index)),
+                       vtbl2_u8(table, vget_high_u8(index)));
+}
+
+static int
+yajl_utf8_any(uint8x16_t v)
+{
+    uint8x8_t folded = vorr_u8(vget_low_u8(v), vget_high_u8(v));
+    return vget_lane_u64(vreinterpret_u64_u8(folded), 0) != 0;
+}
+
+static int
+yajl_utf8_validate_neon(const unsigned char * s, size_t len)
+{
+    uint8x8x2_t firstHigh, firstLow, secondHigh;
+    const uint8x16_t incomplete = vld1q_u8(utf8Incomplete);
+    const uint8x16_t nibble = vdupq_n_u8(0x0F);
+    const uint8x16_t third = vdupq_n_u8(0xE0 - 0x80);
+    const uint8x16_t fourth = vdupq_n_u8(0xF0 - 0x80);
+    const uint8x16_t high = vdupq_n_u8(0x80);
+    uint8x16_t prev = vdupq_n_u8(0);
+    uint8x16_t prevIncomplete = vdupq_n_u8(0);
+    uint8x16_t error = vdupq_n_u8(0);
+    unsigned char tail[16];
+    size_t off;
+
+    firstHigh.val[0] = vld1_u8(utf8FirstHigh);
+    firstHigh.val[1] = vld1_u8(utf8FirstHigh + 8);
+    firstLow.val[0] = vld1_u8(utf8FirstLow);
+    firstLow.val[1] = vld1_u8(utf8FirstLow + 8);
+    secondHigh.val[0] = vld1_u8(utf8SecondHigh);
+    secondHigh.val[1] = vld1_u8(utf8SecondHigh + 8);
+
+    for (off = 0; off < len; off += 16) {
+        uint8x16_t chunk;
+        if (off + 16 <= len) {
+            chunk = vld1q_u8(s + off);
+        } else {
+            /* zeros are ascii, so a sequence cut short shows as too short */
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, s + off, len - off);
+            chunk = vld1q_u8(tail);
         }
-        /* four byte */        
-        else if ((*s >> 3) == 0x1e) {
-            ADV_PTR;
-            if (!((*s >> 6) == 0x2)) return 0;
-            ADV_PTR;
-            if (!((*s >> 6) == 0x2)) return 0;
-            ADV_PTR;
-            if (!((*s >> 6) == 0x2)) return 0;
+        if (!yajl_utf8_any(vandq_u8(chunk, high))) {
+            error = vorrq_u8(error, prevIncomplete);
         } else {
-            return 0;
+            uint8x16_t prev1 = vextq_u8(prev, chunk, 15);
+            uint8x16_t special = vandq_u8(
+                vandq_u8(yajl_utf8_lookup(firstHigh, vshrq_n_u8(prev1, 4)),
+                         yajl_utf8_lookup(firstLow, vandq_u8(prev1, nibble))),
+                yajl_utf8_lookup(secondHigh, vshrq_n_u8(chunk, 4)));
+            uint8x16_t continued = vorrq_u8(
+                vqsubq_u8(vextq_u8(prev, chunk, 14), third),
+                vqsubq_u8(vextq_u8(prev, chunk, 13), fourth));
+            error = vorrq_u8(error, veorq_u8(vandq_u8(continued, high),
+                                             special));
+            prevIncomplete = vqsubq_u8(chunk, incomplete);
         }
-        
-        s++;
+        prev = chunk;
     }
-    
-    return 1;
+    return !yajl_utf8_any(vorrq_u8(error, prevIncomplete));
+}
+#endif
+
+int yajl_string_validate_utf8(const unsigned char * s, size_t len)
+{
+    size_t off = 0;
+
+    if (!len) return 1;
+    if (!s) return 0;
+
+#if defined(__AVX2__)
+    while (off + 32 <= len &&
+           !_mm256_movemask_epi8(
+               _mm256_loadu_si256((const __m256i *) (s + off)))) {
+        off += 32;
+    }
+#endif
+#if defined(__SSE2__)
+    while (off + 16 <= len &&
+           !_mm_movemask_epi8(_mm_loadu_si128((const __m128i *) (s + off)))) {
+        off += 16;
+    }
+#elif defined(YAJL_ENCODE_NEON)
+    {
+        const uint8x16_t high = vdupq_n_u8(0x80);
+        while (off + 16 <= len &&
+               !yajl_utf8_any(vandq_u8(vld1q_u8(s + off), high))) {
+            off += 16;
+        }
+    }
+#endif
+    while (off < len && s[off] < 0x80) off++;
+    if (off == len) return 1;
+
+    /* everything before off is ascii, so a sequence starts there */
+#if defined(YAJL_ENCODE_SSSE3)
+    if (__builtin_cpu_supports("ssse3")) {
+        return yajl_utf8_validate_ssse3(s + off, len - off);
+    }
+#elif defined(YAJL_ENCODE_NEON)
+    return yajl_utf8_validate_neon(s + off, len - off);
+#endif
+    return yajl_utf8_validate_scalar(s + off, len - off);
 }
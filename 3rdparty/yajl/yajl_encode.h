@@ -26,9 +26,26 @@ void yajl_string_encode(const yajl_print_t printer,
                         size_t length,
                         int escape_solidus);
 
+/* the length of str once escaped, for sizing the output of
+ * yajl_string_escape */
+size_t yajl_string_escaped_length(const unsigned char * str,
+                                  size_t length,
+                                  int escape_solidus);
+
+/* write the escaped form of str to out and return its length */
+size_t yajl_string_escape(unsigned char * out,
+                          const unsigned char * str,
+                          size_t length,
+                          int escape_solidus);
+
 void yajl_string_decode(yajl_buf buf, const unsigned char * str,
                         size_t length);
 
+/* unescape length bytes of str into out, which may be str itself, and
+ * return the decoded length.  it is never more than length. */
+size_t yajl_string_unescape(unsigned char * out, const unsigned char * str,
+                            size_t length);
+
 int yajl_string_validate_utf8(const unsigned char * s, size_t len);
 
 #endif
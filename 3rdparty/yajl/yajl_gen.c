@@ -263,9 +263,21 @@ yajl_gen_string(yajl_gen g, const unsigned char * str,
         }
     }
     ENSURE_VALID_STATE; INSERT_SEP; INSERT_WHITESPACE;
-    g->print(g->ctx, "\"", 1);
-    yajl_string_encode(g->print, g->ctx, str, len, g->flags & yajl_gen_escape_solidus);
-    g->print(g->ctx, "\"", 1);
+    if (g->print == (yajl_print_t)&yajl_buf_append) {
+        /* size the escaped string and write it, quotes included, in one
+         * reservation */
+        int solidus = g->flags & yajl_gen_escape_solidus;
+        size_t escaped = yajl_string_escaped_length(str, len, solidus);
+        unsigned char * out = yajl_buf_reserve((yajl_buf)g->ctx, escaped + 2);
+        out[0] = '"';
+        yajl_string_escape(out + 1, str, len, solidus);
+        out[escaped + 1] = '"';
+        yajl_buf_commit((yajl_buf)g->ctx, escaped + 2);
+    } else {
+        g->print(g->ctx, "\"", 1);
+        yajl_string_encode(g->print, g->ctx, str, len, g->flags & yajl_gen_escape_solidus);
+        g->print(g->ctx, "\"", 1);
+    }
     APPENDED_ATOM;
     FINAL_NEWLINE;
     return yajl_gen_status_ok;
@@ -16,12 +16,20 @@
 
 #include "yajl_lex.h"
 #include "yajl_buf.h"
+#include "yajl_encode.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define YAJL_LEX_NEON 1
+#endif
+
 #ifdef YAJL_LEXER_DEBUG
 static const char *
 tokToStr(yajl_tok tok)
@@ -196,39 +204,36 @@ yajl_lex_utf8_char(yajl_lexer lexer, const unsigned char * jsonText,
                    size_t jsonTextLen, size_t * offset,
                    unsigned char curChar)
 {
+    /* the range of the second byte rules out overlong forms, surrogates
+     * and code points past U+10FFFF, as yajl_string_validate_utf8 does */
+    unsigned char lo = 0x80, hi = 0xBF;
+    unsigned int follow;
+
     if (curChar <= 0x7f) {
         /* single byte */
         return yajl_tok_string;
-    } else if ((curChar >> 5) == 0x6) {
-        /* two byte */
-        UTF8_CHECK_EOF;
-        curChar = readChar(lexer, jsonText, offset);
-        if ((curChar >> 6) == 0x2) return yajl_tok_string;
-    } else if ((curChar >> 4) == 0x0e) {
-        /* three byte */
-        UTF8_CHECK_EOF;
-        curChar = readChar(lexer, jsonText, offset);
-        if ((curChar >> 6) == 0x2) {
-            UTF8_CHECK_EOF;
-            curChar = readChar(lexer, jsonText, offset);
-            if ((curChar >> 6) == 0x2) return yajl_tok_string;
-        }
-    } else if ((curChar >> 3) == 0x1e) {
-        /* four byte */
+    } else if (curChar < 0xC2 || curChar > 0xF4) {
+        return yajl_tok_error;
+    } else if (curChar < 0xE0) {
+        follow = 1;
+    } else if (curChar < 0xF0) {
+        follow = 2;
+        if (curChar == 0xE0) lo = 0xA0;
+        else if (curChar == 0xED) hi = 0x9F;
+    } else {
+        follow = 3;
+        if (curChar == 0xF0) lo = 0x90;
+        else if (curChar == 0xF4) hi = 0x8F;
+    }
+
+    while (follow--) {
         UTF8_CHECK_EOF;
         curChar = readChar(lexer, jsonText, offset);
-        if ((curChar >> 6) == 0x2) {
-            UTF8_CHECK_EOF;
-            curChar = readChar(lexer, jsonText, offset);
-            if ((curChar >> 6) == 0x2) {
-                UTF8_CHECK_EOF;
-                curChar = readChar(lexer, jsonText, offset);
-                if ((curChar >> 6) == 0x2) return yajl_tok_string;
-            }
-        }
+        if (curChar < lo || curChar > hi) return yajl_tok_error;
+        lo = 0x80;
+        hi = 0xBF;
     }
-
-    return yajl_tok_error;
+    return yajl_tok_string;
 }
 
 /* lex a string.  input is the lexer, pointer to beginning of
@@ -249,13 +254,62 @@ if (*offset >= jsonTextLen) { \
 
 /** scan a string for interesting characters that might need further
  *  review.  return the number of chars that are uninteresting and can
- *  be skipped.
- * (lth) hi world, any thoughts on how to make this routine faster? */
+ *  be skipped.  those are quotes, backslashes, control chars and, when
+ *  validating utf8, anything with the high bit set.  sixteen bytes are
+ *  tested at a time with SSE2 or NEON and the table finishes the rest. */
 static size_t
 yajl_string_scan(const unsigned char * buf, size_t len, int utf8check)
 {
     unsigned char mask = IJC|NFP|(utf8check ? NUC : 0);
     size_t skip = 0;
+
+#if defined(__SSE2__)
+    {
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i control = _mm_set1_epi8(0x1f);
+        const __m128i space = _mm_set1_epi8(0x20);
+        while (skip + 16 <= len) {
+            __m128i chunk = _mm_loadu_si128((const __m128i *) (buf + skip));
+            __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                        _mm_cmpeq_epi8(chunk, backslash));
+            /* a signed compare against 0x20 also catches every byte with
+             * the high bit set, which is exactly what utf8 checking wants */
+            if (utf8check) {
+                hits = _mm_or_si128(hits, _mm_cmplt_epi8(chunk, space));
+            } else {
+                hits = _mm_or_si128(hits, _mm_cmpeq_epi8(
+                           _mm_max_epu8(chunk, control), control));
+            }
+            {
+                unsigned int found = (unsigned int) _mm_movemask_epi8(hits);
+                if (found) return skip + __builtin_ctz(found);
+            }
+            skip += 16;
+        }
+    }
+#elif defined(YAJL_LEX_NEON)
+    {
+        const uint8x16_t quote = vdupq_n_u8('"');
+        const uint8x16_t backslash = vdupq_n_u8('\\');
+        const uint8x16_t space = vdupq_n_u8(0x20);
+        const uint8x16_t high = vdupq_n_u8(0x80);
+        while (skip + 16 <= len) {
+            uint8x16_t chunk = vld1q_u8(buf + skip);
+            uint8x16_t hits = vorrq_u8(vceqq_u8(chunk, quote),
+                                       vceqq_u8(chunk, backslash));
+            uint8x8_t folded;
+            hits = vorrq_u8(hits, vcltq_u8(chunk, space));
+            if (utf8check) hits = vorrq_u8(hits, vcgeq_u8(chunk, high));
+            folded = vorr_u8(vget_low_u8(hits), vget_high_u8(hits));
+            /* no movemask here, the table walk below finds the byte */
+            if (vget_lane_u64(vreinterpret_u64_u8(folded), 0)) break;
+            skip += 16;
+        }
+    }
+#endif
+
+    buf += skip;
     while (skip < len && !(charLookupTable[*buf] & mask))
     {
         skip++;
@@ -273,6 +327,7 @@ yajl_lex_string(yajl_lexer lexer, const unsigned char * jsonText,
 
     for (;;) {
         unsigned char curChar;
+        int inText = 0;
 
         /* now jump into a faster scanning routine to skip as much
          * of the buffers as possible */
@@ -293,6 +348,7 @@ yajl_lex_string(yajl_lexer lexer, const unsigned char * jsonText,
                 p = jsonText + *offset;
                 len = jsonTextLen - *offset;
                 *offset += yajl_string_scan(p, len, lexer->validateUTF8);
+                inText = 1;
             }
         }
 
@@ -340,7 +396,28 @@ yajl_lex_string(yajl_lexer lexer, const unsigned char * jsonText,
             lexer->error = yajl_lex_string_invalid_json_char;
             goto finish_string_lex;
         }
-        /* when in validate UTF8 mode we need to do some extra work */
+        /* when in validate UTF8 mode we need to do some extra work.  in
+         * the input text, the whole run up to the next quote, backslash or
+         * control char is validated in one go.  a run that reaches the end
+         * of the input is left alone since the string is then incomplete,
+         * and all of it is lexed again once the rest arrives. */
+        else if (lexer->validateUTF8 && inText) {
+            const unsigned char * p = jsonText + *offset - 1;
+            size_t len = jsonTextLen - *offset + 1;
+            size_t run = yajl_string_scan(p, len, 0);
+
+            if (run == len) {
+                *offset = jsonTextLen;
+                tok = yajl_tok_eof;
+                goto finish_string_lex;
+            }
+            if (!yajl_string_validate_utf8(p, run)) {
+                unreadChar(lexer, offset);
+                lexer->error = yajl_lex_string_invalid_utf8;
+                goto finish_string_lex;
+            }
+            *offset += run - 1;
+        }
         else if (lexer->validateUTF8) {
             yajl_tok t = yajl_lex_utf8_char(lexer, jsonText, jsonTextLen,
                                             offset, curChar);
@@ -17,6 +17,7 @@
 #include "api/yajl_parse.h"
 #include "yajl_lex.h"
 #include "yajl_parser.h"
+#include "yajl_number.h"
 #include "yajl_encode.h"
 #include "yajl_bytestack.h"
 
@@ -29,36 +30,29 @@
 #include <assert.h>
 #include <math.h>
 
-#define MAX_VALUE_TO_MULTIPLY ((LLONG_MAX / 10) + (LLONG_MAX % 10))
-
- /* same semantics as strtol */
-long long
-yajl_parse_integer(const unsigned char *number, unsigned int length)
+/* point buf at the decoded form of a string token, unescaping it in the
+ * caller's text when yajl_decode_in_place allows and the token lies there,
+ * otherwise into decodeBuf when it has escapes. */
+static void
+yajl_decode_string(yajl_handle hand, const unsigned char * jsonText,
+                   size_t jsonTextLen, yajl_tok tok,
+                   const unsigned char ** buf, size_t * bufLen)
 {
-    long long ret  = 0;
-    long sign = 1;
-    const unsigned char *pos = number;
-    if (*pos == '-') { pos++; sign = -1; }
-    if (*pos == '+') { pos++; }
-
-    while (pos < number + length) {
-        if ( ret > MAX_VALUE_TO_MULTIPLY ) {
-            errno = ERANGE;
-            return sign == 1 ? LLONG_MAX : LLONG_MIN;
-        }
-        ret *= 10;
-        if (LLONG_MAX - ret < (*pos - '0')) {
-            errno = ERANGE;
-            return sign == 1 ? LLONG_MAX : LLONG_MIN;
-        }
-        if (*pos < '0' || *pos > '9') {
-            errno = ERANGE;
-            return sign == 1 ? LLONG_MAX : LLONG_MIN;
+    if ((hand->flags & yajl_decode_in_place) && *buf >= jsonText &&
+        *buf + *bufLen < jsonText + jsonTextLen)
+    {
+        unsigned char * str = (unsigned char *) *buf;
+        if (tok == yajl_tok_string_with_escapes) {
+            *bufLen = yajl_string_unescape(str, str, *bufLen);
         }
-        ret += (*pos++ - '0');
+        str[*bufLen] = 0;
+    }
+    else if (tok == yajl_tok_string_with_escapes) {
+        yajl_buf_clear(hand->decodeBuf);
+        yajl_string_decode(hand->decodeBuf, *buf, *bufLen);
+        *buf = yajl_buf_data(hand->decodeBuf);
+        *bufLen = yajl_buf_len(hand->decodeBuf);
     }
-
-    return sign * ret;
 }
 
 unsigned char *
@@ -239,20 +233,14 @@ yajl_do_parse(yajl_handle hand, const unsigned char * jsonText,
                     yajl_bs_set(hand->stateStack, yajl_state_lexical_error);
                     goto around_again;
                 case yajl_tok_string:
+                case yajl_tok_string_with_escapes:
                     if (hand->callbacks && hand->callbacks->yajl_string) {
+                        yajl_decode_string(hand, jsonText, jsonTextLen, tok,
+                                           &buf, &bufLen);
                         _CC_CHK(hand->callbacks->yajl_string(hand->ctx,
                                                              buf, bufLen));
                     }
                     break;
-                case yajl_tok_string_with_escapes:
-                    if (hand->callbacks && hand->callbacks->yajl_string) {
-                        yajl_buf_clear(hand->decodeBuf);
-                        yajl_string_decode(hand->decodeBuf, buf, bufLen);
-                        _CC_CHK(hand->callbacks->yajl_string(
-                                    hand->ctx, yajl_buf_data(hand->decodeBuf),
-                                    yajl_buf_len(hand->decodeBuf)));
-                    }
-                    break;
                 case yajl_tok_bool:
                     if (hand->callbacks && hand->callbacks->yajl_boolean) {
                         _CC_CHK(hand->callbacks->yajl_boolean(hand->ctx,
@@ -308,11 +296,13 @@ yajl_do_parse(yajl_handle hand, const unsigned char * jsonText,
                                         hand->ctx, (const char *) buf, bufLen));
                         } else if (hand->callbacks->yajl_double) {
                             double d = 0.0;
-                            yajl_buf_clear(hand->decodeBuf);
-                            yajl_buf_append(hand->decodeBuf, buf, bufLen);
-                            buf = yajl_buf_data(hand->decodeBuf);
                             errno = 0;
-                            d = strtod((char *) buf, NULL);
+                            if (!yajl_parse_double(buf, bufLen, &d)) {
+                                yajl_buf_clear(hand->decodeBuf);
+                                yajl_buf_append(hand->decodeBuf, buf, bufLen);
+                                buf = yajl_buf_data(hand->decodeBuf);
+                                d = strtod((char *) buf, NULL);
+                            }
                             if ((d == HUGE_VAL || d == -HUGE_VAL) &&
                                 errno == ERANGE)
                             {
@@ -387,15 +377,10 @@ yajl_do_parse(yajl_handle hand, const unsigned char * jsonText,
                     yajl_bs_set(hand->stateStack, yajl_state_lexical_error);
                     goto around_again;
                 case yajl_tok_string_with_escapes:
-                    if (hand->callbacks && hand->callbacks->yajl_map_key) {
-                        yajl_buf_clear(hand->decodeBuf);
-                        yajl_string_decode(hand->decodeBuf, buf, bufLen);
-                        buf = yajl_buf_data(hand->decodeBuf);
-                        bufLen = yajl_buf_len(hand->decodeBuf);
-                    }
-                    /* intentional fall-through */
                 case yajl_tok_string:
                     if (hand->callbacks && hand->callbacks->yajl_map_key) {
+                        yajl_decode_string(hand, jsonText, jsonTextLen, tok,
+                                           &buf, &bufLen);
                         _CC_CHK(hand->callbacks->yajl_map_key(hand->ctx, buf,
                                                               bufLen));
                     }
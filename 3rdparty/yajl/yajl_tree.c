@@ -24,6 +24,8 @@
 #include "api/yajl_parse.h"
 
 #include "yajl_parser.h"
+#include "yajl_alloc.h"
+#include "yajl_number.h"
 
 #if defined(_WIN32) || defined(WIN32)
 #define snprintf sprintf_s
@@ -47,6 +49,10 @@ struct context_s
     yajl_val root;
     char *errbuf;
     size_t errbuf_size;
+    yajl_alloc_funcs *afs;
+    /* set when parsing in place, strings inside it are not copied */
+    const unsigned char *input;
+    size_t input_len;
 };
 typedef struct context_s context_t;
 
@@ -56,11 +62,11 @@ typedef struct context_s context_t;
         return (retval);                                                \
     }
 
-static yajl_val value_alloc (yajl_type type)
+static yajl_val value_alloc (context_t *ctx, yajl_type type)
 {
     yajl_val v;
 
-    v = malloc (sizeof (*v));
+    v = YA_MALLOC (ctx->afs, sizeof (*v));
     if (v == NULL) return (NULL);
     memset (v, 0, sizeof (*v));
     v->type = type;
@@ -68,7 +74,7 @@ static yajl_val value_alloc (yajl_type type)
     return (v);
 }
 
-static void yajl_object_free (yajl_val v)
+static void yajl_object_free (yajl_val v, yajl_alloc_funcs *afs)
 {
     size_t i;
 
@@ -76,18 +82,18 @@ static void yajl_object_free (yajl_val v)
 
     for (i = 0; i < v->u.object.len; i++)
     {
-        free((char *) v->u.object.keys[i]);
+        YA_FREE(afs, (char *) v->u.object.keys[i]);
         v->u.object.keys[i] = NULL;
-        yajl_tree_free (v->u.object.values[i]);
+        yajl_tree_free_alloc (v->u.object.values[i], afs);
         v->u.object.values[i] = NULL;
     }
 
-    free((void*) v->u.object.keys);
-    free(v->u.object.values);
-    free(v);
+    YA_FREE(afs, (void*) v->u.object.keys);
+    YA_FREE(afs, v->u.object.values);
+    YA_FREE(afs, v);
 }
 
-static void yajl_array_free (yajl_val v)
+static void yajl_array_free (yajl_val v, yajl_alloc_funcs *afs)
 {
     size_t i;
 
@@ -95,12 +101,30 @@ static void yajl_array_free (yajl_val v)
 
     for (i = 0; i < v->u.array.len; i++)
     {
-        yajl_tree_free (v->u.array.values[i]);
+        yajl_tree_free_alloc (v->u.array.values[i], afs);
         v->u.array.values[i] = NULL;
     }
 
-    free(v->u.array.values);
-    free(v);
+    YA_FREE(afs, v->u.array.values);
+    YA_FREE(afs, v);
+}
+
+/*
+ * Member arrays grow geometrically. Their capacity is not stored, it is the
+ * smallest power of two, and at least MIN_MEMBERS, that holds "len".
+ */
+#define MIN_MEMBERS 4
+
+static int members_full (size_t len)
+{
+    if (len == 0) return 1;
+    if (len < MIN_MEMBERS) return 0;
+    return (len & (len - 1)) == 0;
+}
+
+static size_t members_grow (size_t len)
+{
+    return (len == 0) ? MIN_MEMBERS : len * 2;
 }
 
 /*
@@ -114,7 +138,7 @@ static int context_push(context_t *ctx, yajl_val v)
 {
     stack_elem_t *stack;
 
-    stack = malloc (sizeof (*stack));
+    stack = YA_MALLOC (ctx->afs, sizeof (*stack));
     if (stack == NULL)
         RETURN_ERROR (ctx, ENOMEM, "Out of memory");
     memset (stack, 0, sizeof (*stack));
@@ -144,7 +168,7 @@ static yajl_val context_pop(context_t *ctx)
 
     v = stack->value;
 
-    free (stack);
+    YA_FREE (ctx->afs, stack);
 
     return (v);
 }
@@ -164,15 +188,19 @@ static int object_add_keyval(context_t *ctx,
     /* We're assuring that "obj" is an object in "context_add_value". */
     assert(YAJL_IS_OBJECT(obj));
 
-    tmpk = realloc((void *) obj->u.object.keys, sizeof(*(obj->u.object.keys)) * (obj->u.object.len + 1));
-    if (tmpk == NULL)
-        RETURN_ERROR(ctx, ENOMEM, "Out of memory");
-    obj->u.object.keys = tmpk;
+    if (members_full(obj->u.object.len)) {
+        size_t size = members_grow(obj->u.object.len);
 
-    tmpv = realloc(obj->u.object.values, sizeof (*obj->u.object.values) * (obj->u.object.len + 1));
-    if (tmpv == NULL)
-        RETURN_ERROR(ctx, ENOMEM, "Out of memory");
-    obj->u.object.values = tmpv;
+        tmpk = YA_REALLOC(ctx->afs, (void *) obj->u.object.keys, sizeof(*(obj->u.object.keys)) * size);
+        if (tmpk == NULL)
+            RETURN_ERROR(ctx, ENOMEM, "Out of memory");
+        obj->u.object.keys = tmpk;
+
+        tmpv = YA_REALLOC(ctx->afs, obj->u.object.values, sizeof (*obj->u.object.values) * size);
+        if (tmpv == NULL)
+            RETURN_ERROR(ctx, ENOMEM, "Out of memory");
+        obj->u.object.values = tmpv;
+    }
 
     obj->u.object.keys[obj->u.object.len] = key;
     obj->u.object.values[obj->u.object.len] = value;
@@ -195,11 +223,13 @@ static int array_add_value (context_t *ctx,
     /* "context_add_value" will only call us with array values. */
     assert(YAJL_IS_ARRAY(array));
 
-    tmp = realloc(array->u.array.values,
-                  sizeof(*(array->u.array.values)) * (array->u.array.len + 1));
-    if (tmp == NULL)
-        RETURN_ERROR(ctx, ENOMEM, "Out of memory");
-    array->u.array.values = tmp;
+    if (members_full(array->u.array.len)) {
+        tmp = YA_REALLOC(ctx->afs, array->u.array.values,
+                         sizeof(*(array->u.array.values)) * members_grow(array->u.array.len));
+        if (tmp == NULL)
+            RETURN_ERROR(ctx, ENOMEM, "Out of memory");
+        array->u.array.values = tmp;
+    }
     array->u.array.values[array->u.array.len] = value;
     array->u.array.len++;
 
@@ -244,7 +274,7 @@ static int context_add_value (context_t *ctx, yajl_val v)
 
             ctx->stack->key = v->u.string;
             v->u.string = NULL;
-            free(v);
+            YA_FREE(ctx->afs, v);
             return (0);
         }
         else /* if (ctx->key != NULL) */
@@ -273,14 +303,23 @@ static int handle_string (void *ctx,
 {
     yajl_val v;
 
-    v = value_alloc (yajl_t_string);
+    v = value_alloc ((context_t *) ctx, yajl_t_string);
     if (v == NULL)
         RETURN_ERROR ((context_t *) ctx, STATUS_ABORT, "Out of memory");
 
-    v->u.string = malloc (string_length + 1);
+    /* decoded in place and already NUL terminated */
+    if (((context_t *) ctx)->input != NULL &&
+        string >= ((context_t *) ctx)->input &&
+        string + string_length < ((context_t *) ctx)->input + ((context_t *) ctx)->input_len)
+    {
+        v->u.string = (char *) string;
+        return ((context_add_value (ctx, v) == 0) ? STATUS_CONTINUE : STATUS_ABORT);
+    }
+
+    v->u.string = YA_MALLOC (((context_t *) ctx)->afs, string_length + 1);
     if (v->u.string == NULL)
     {
-        free (v);
+        YA_FREE (((context_t *) ctx)->afs, v);
         RETURN_ERROR ((context_t *) ctx, STATUS_ABORT, "Out of memory");
     }
     memcpy(v->u.string, string, string_length);
@@ -289,38 +328,42 @@ static int handle_string (void *ctx,
     return ((context_add_value (ctx, v) == 0) ? STATUS_CONTINUE : STATUS_ABORT);
 }
 
+/* the number points into an input parsed in place and is followed by the
+ * byte after it rather than a terminator */
+#define NUMBER_UNTERMINATED 0x100
+
+/* numbers are converted on first use by yajl_tree_number_flags, so parsing
+ * only records where the token is */
 static int handle_number (void *ctx, const char *string, size_t string_length)
 {
+    context_t *c = (context_t *) ctx;
     yajl_val v;
-    char *endptr;
 
-    v = value_alloc(yajl_t_number);
+    v = value_alloc(c, yajl_t_number);
     if (v == NULL)
-        RETURN_ERROR((context_t *) ctx, STATUS_ABORT, "Out of memory");
+        RETURN_ERROR(c, STATUS_ABORT, "Out of memory");
 
-    v->u.number.r = malloc(string_length + 1);
+    v->u.number.len = string_length;
+    v->u.number.flags = 0;
+
+    if (c->input != NULL &&
+        (const unsigned char *) string >= c->input &&
+        (const unsigned char *) string + string_length < c->input + c->input_len)
+    {
+        v->u.number.r = (char *) string;
+        v->u.number.flags = NUMBER_UNTERMINATED;
+        return ((context_add_value(ctx, v) == 0) ? STATUS_CONTINUE : STATUS_ABORT);
+    }
+
+    v->u.number.r = YA_MALLOC(c->afs, string_length + 1);
     if (v->u.number.r == NULL)
     {
-        free(v);
-        RETURN_ERROR((context_t *) ctx, STATUS_ABORT, "Out of memory");
+        YA_FREE(c->afs, v);
+        RETURN_ERROR(c, STATUS_ABORT, "Out of memory");
     }
     memcpy(v->u.number.r, string, string_length);
     v->u.number.r[string_length] = 0;
 
-    v->u.number.flags = 0;
-
-    errno = 0;
-    v->u.number.i = yajl_parse_integer((const unsigned char *) v->u.number.r,
-                                       strlen(v->u.number.r));
-    if (errno == 0)
-        v->u.number.flags |= YAJL_NUMBER_INT_VALID;
-
-    endptr = NULL;
-    errno = 0;
-    v->u.number.d = strtod(v->u.number.r, &endptr);
-    if ((errno == 0) && (endptr != NULL) && (*endptr == 0))
-        v->u.number.flags |= YAJL_NUMBER_DOUBLE_VALID;
-
     return ((context_add_value(ctx, v) == 0) ? STATUS_CONTINUE : STATUS_ABORT);
 }
 
@@ -328,7 +371,7 @@ static int handle_start_map (void *ctx)
 {
     yajl_val v;
 
-    v = value_alloc(yajl_t_object);
+    v = value_alloc ((context_t *) ctx, yajl_t_object);
     if (v == NULL)
         RETURN_ERROR ((context_t *) ctx, STATUS_ABORT, "Out of memory");
 
@@ -354,7 +397,7 @@ static int handle_start_array (void *ctx)
 {
     yajl_val v;
 
-    v = value_alloc(yajl_t_array);
+    v = value_alloc ((context_t *) ctx, yajl_t_array);
     if (v == NULL)
         RETURN_ERROR ((context_t *) ctx, STATUS_ABORT, "Out of memory");
 
@@ -379,7 +422,7 @@ static int handle_boolean (void *ctx, int boolean_value)
 {
     yajl_val v;
 
-    v = value_alloc (boolean_value ? yajl_t_true : yajl_t_false);
+    v = value_alloc ((context_t *) ctx, boolean_value ? yajl_t_true : yajl_t_false);
     if (v == NULL)
         RETURN_ERROR ((context_t *) ctx, STATUS_ABORT, "Out of memory");
 
@@ -390,7 +433,7 @@ static int handle_null (void *ctx)
 {
     yajl_val v;
 
-    v = value_alloc (yajl_t_null);
+    v = value_alloc ((context_t *) ctx, yajl_t_null);
     if (v == NULL)
         RETURN_ERROR ((context_t *) ctx, STATUS_ABORT, "Out of memory");
 
@@ -402,6 +445,13 @@ static int handle_null (void *ctx)
  */
 yajl_val yajl_tree_parse (const char *input,
                           char *error_buffer, size_t error_buffer_size)
+{
+    return yajl_tree_parse_alloc(input, NULL, error_buffer, error_buffer_size);
+}
+
+static yajl_val tree_parse (const char *input, size_t input_len,
+                            yajl_alloc_funcs *afs, int in_place,
+                            char *error_buffer, size_t error_buffer_size)
 {
     static const yajl_callbacks callbacks =
         {
@@ -421,26 +471,38 @@ yajl_val yajl_tree_parse (const char *input,
     yajl_handle handle;
     yajl_status status;
     char * internal_err_str;
-	context_t ctx = { NULL, NULL, NULL, 0 };
+    yajl_alloc_funcs afsBuffer;
+	context_t ctx = { NULL, NULL, NULL, 0, NULL, NULL, 0 };
 
 	ctx.errbuf = error_buffer;
 	ctx.errbuf_size = error_buffer_size;
 
+    if (afs == NULL) {
+        yajl_set_default_alloc_funcs(&afsBuffer);
+        afs = &afsBuffer;
+    }
+    ctx.afs = afs;
+
     if (error_buffer != NULL)
         memset (error_buffer, 0, error_buffer_size);
 
-    handle = yajl_alloc (&callbacks, NULL, &ctx);
+    handle = yajl_alloc (&callbacks, afs, &ctx);
     yajl_config(handle, yajl_allow_comments, 1);
+    if (in_place) {
+        yajl_config(handle, yajl_decode_in_place, 1);
+        ctx.input = (const unsigned char *) input;
+        ctx.input_len = input_len;
+    }
 
     status = yajl_parse(handle,
                         (unsigned char *) input,
-                        strlen (input));
+                        input_len);
     status = yajl_complete_parse (handle);
     if (status != yajl_status_ok) {
         if (error_buffer != NULL && error_buffer_size > 0) {
                internal_err_str = (char *) yajl_get_error(handle, 1,
                      (const unsigned char *) input,
-                     strlen(input));
+                     input_len);
              snprintf(error_buffer, error_buffer_size, "%s", internal_err_str);
              YA_FREE(&(handle->alloc), internal_err_str);
         }
@@ -452,6 +514,21 @@ yajl_val yajl_tree_parse (const char *input,
     return (ctx.root);
 }
 
+yajl_val yajl_tree_parse_alloc (const char *input, yajl_alloc_funcs *afs,
+                                char *error_buffer, size_t error_buffer_size)
+{
+    return tree_parse(input, strlen(input), afs, 0,
+                      error_buffer, error_buffer_size);
+}
+
+yajl_val yajl_tree_parse_in_place (char *input, size_t length,
+                                   yajl_alloc_funcs *afs,
+                                   char *error_buffer, size_t error_buffer_size)
+{
+    return tree_parse(input, length, afs, 1,
+                      error_buffer, error_buffer_size);
+}
+
 yajl_val yajl_tree_get(yajl_val n, const char ** path, yajl_type type)
 {
     if (!path) return NULL;
@@ -474,30 +551,78 @@ yajl_val yajl_tree_get(yajl_val n, const char ** path, yajl_type type)
     return n;
 }
 
+char * yajl_tree_number_string (yajl_val v)
+{
+    /* the parse is over, so the byte after the number is no longer needed */
+    if (v->u.number.flags & NUMBER_UNTERMINATED) {
+        v->u.number.r[v->u.number.len] = 0;
+        v->u.number.flags &= ~NUMBER_UNTERMINATED;
+    }
+    return v->u.number.r;
+}
+
+unsigned int yajl_tree_number_flags (yajl_val v)
+{
+    const unsigned char *r = (const unsigned char *) v->u.number.r;
+    size_t len = v->u.number.len;
+
+    if (v->u.number.flags & YAJL_NUMBER_PARSED)
+        return v->u.number.flags;
+    v->u.number.flags |= YAJL_NUMBER_PARSED;
+
+    errno = 0;
+    v->u.number.i = yajl_parse_integer(r, len);
+    if (errno == 0)
+        v->u.number.flags |= YAJL_NUMBER_INT_VALID;
+
+    if (yajl_parse_double(r, len, &v->u.number.d))
+    {
+        v->u.number.flags |= YAJL_NUMBER_DOUBLE_VALID;
+    }
+    else
+    {
+        char *endptr = NULL;
+        errno = 0;
+        v->u.number.d = strtod(yajl_tree_number_string(v), &endptr);
+        if ((errno == 0) && (endptr != NULL) && (*endptr == 0))
+            v->u.number.flags |= YAJL_NUMBER_DOUBLE_VALID;
+    }
+
+    return v->u.number.flags;
+}
+
 void yajl_tree_free (yajl_val v)
+{
+    yajl_alloc_funcs afs;
+
+    yajl_set_default_alloc_funcs(&afs);
+    yajl_tree_free_alloc(v, &afs);
+}
+
+void yajl_tree_free_alloc (yajl_val v, yajl_alloc_funcs *afs)
 {
     if (v == NULL) return;
 
     if (YAJL_IS_STRING(v))
     {
-        free(v->u.string);
-        free(v);
+        YA_FREE(afs, v->u.string);
+        YA_FREE(afs, v);
     }
     else if (YAJL_IS_NUMBER(v))
     {
-        free(v->u.number.r);
-        free(v);
+        YA_FREE(afs, v->u.number.r);
+        YA_FREE(afs, v);
     }
     else if (YAJL_GET_OBJECT(v))
     {
-        yajl_object_free(v);
+        yajl_object_free(v, afs);
     }
     else if (YAJL_GET_ARRAY(v))
     {
-        yajl_array_free(v);
+        yajl_array_free(v, afs);
     }
     else /* if (yajl_t_true or yajl_t_false or yajl_t_null) */
     {
-        free(v);
+        YA_FREE(afs, v);
     }
 }
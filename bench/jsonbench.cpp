@@ -0,0 +1,853 @@
+// Host benchmark of the signaling message path: parsing, key lookup,
+// generation and framing, each run over every message of a corpus. The
+// find_keys cases run over generated objects of several sizes instead.
+// Prints one JSON object per case and message, so runs can be kept and
+// compared line by line.
+//
+//   jsonbench [-t seconds] [-c case] [-s seed] message.json...
+
+#include "api/yajl_gen.h"
+#include "api/yajl_tree.h"
+#include "cbor.h"
+#include "framer.h"
+#include "json.h"
+#include "scan.h"
+#include "tape.h"
+#include "websocket.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+// Every malloc, calloc and realloc, counting those behind operator new, goes
+// through these so a case can report allocations per message.
+extern "C" {
+void* __libc_malloc(size_t aSize);
+void* __libc_calloc(size_t aCount, size_t aSize);
+void* __libc_realloc(void* aPtr, size_t aSize);
+void __libc_free(void* aPtr);
+}
+
+static unsigned long long sAllocations = 0;
+
+extern "C" void*
+malloc(size_t aSize)
+{
+  sAllocations++;
+  return __libc_malloc(aSize);
+}
+
+extern "C" void*
+calloc(size_t aCount, size_t aSize)
+{
+  sAllocations++;
+  return __libc_calloc(aCount, aSize);
+}
+
+extern "C" void*
+realloc(void* aPtr, size_t aSize)
+{
+  sAllocations++;
+  return __libc_realloc(aPtr, aSize);
+}
+
+extern "C" void
+free(void* aPtr)
+{
+  __libc_free(aPtr);
+}
+
+// Reads the size of TCP segments carrying the message, so framing sees the
+// same partial reads as on a real connection.
+static const size_t sReadSize = 1448;
+// The _random framing cases cut the wire at lengths drawn from a generator
+// seeded with this instead, so reads end inside terminators, prefixes and
+// frame headers and the framer resumes from all of them.
+static uint32_t sSeed = 1;
+static const char sTerminator[] = "\r\n";
+static const size_t sTerminatorSize = sizeof(sTerminator) - 1;
+
+static const JSONKey sTypeKey("type");
+static const JSONKey sSdpKey("sdp");
+static const JSONKey sCandidateKey("candidate");
+static const JSONKey sSdpMidKey("sdpMid");
+static const JSONKey sSdpMLineIndexKey("sdpMLineIndex");
+
+struct Message {
+  std::string name;
+  std::string text;
+  // Wire forms of the message for each framing.
+  std::string delimited;
+  std::string prefixed;
+  std::string webSocket;
+  // The same fields encoded as the player encodes CBOR signaling.
+  std::string cbor;
+  // Every key of a generated object, for the find_keys cases.
+  std::vector<std::string> keys;
+  std::vector<JSONKey> jsonKeys;
+};
+
+// Object sizes the find_keys cases sweep, either side of the 12 keys at
+// which JSONParser starts indexing an object.
+static const int sObjectSizes[] = { 4, 8, 11, 12, 13, 16, 32, 64, 128, 256 };
+
+static double
+Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static bool
+ReadFile(const char* aPath, std::string& aText)
+{
+  FILE* file = fopen(aPath, "rb");
+  if (!file) {
+    return false;
+  }
+  char buffer[4096];
+  size_t read = 0;
+  aText.clear();
+  while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    aText.append(buffer, read);
+  }
+  fclose(file);
+  return true;
+}
+
+// A masked client frame, as a browser sends it.
+static void
+MaskFrame(const std::string& aText, std::string& aFrame)
+{
+  static const uint8_t mask[4] = { 0x37, 0xfa, 0x21, 0x3d };
+  const size_t length = aText.length();
+  aFrame.clear();
+  aFrame += (char)(0x80 | websocket::OpText);
+  if (length < 126) {
+    aFrame += (char)(0x80 | length);
+  }
+  else if (length < 0x10000) {
+    aFrame += (char)(0x80 | 126);
+    aFrame += (char)(length >> 8);
+    aFrame += (char)length;
+  }
+  else {
+    aFrame += (char)(0x80 | 127);
+    for (int shift = 56; shift >= 0; shift -= 8) {
+      aFrame += (char)((uint64_t)length >> shift);
+    }
+  }
+  aFrame.append((const char*)mask, sizeof(mask));
+  for (size_t ix = 0; ix < length; ix++) {
+    aFrame += (char)(aText[ix] ^ mask[ix & 3]);
+  }
+}
+
+// Encodes the message's fields the way the player writes answers and
+// candidates.
+template<class Generator>
+static bool
+GenerateSignals(Generator& aGen, const std::vector<SignalMessage>& aSignals, bool aBatch)
+{
+  if (aBatch) {
+    aGen.openArray();
+  }
+  for (size_t ix = 0; ix < aSignals.size(); ix++) {
+    const SignalMessage& signal = aSignals[ix];
+    aGen.openMap();
+    if (signal.has(SignalMessage::FieldType)) {
+      aGen.addPair("type", signal.type);
+      aGen.addPair("sdp", signal.sdp);
+    }
+    else {
+      aGen.addPair("candidate", signal.candidate);
+      aGen.addPair("sdpMid", signal.sdpMid);
+      aGen.addPair("sdpMLineIndex", signal.sdpMLineIndex);
+    }
+    if (!aGen.closeMap()) {
+      return false;
+    }
+  }
+  if (aBatch) {
+    aGen.closeArray();
+  }
+  return true;
+}
+
+static bool
+DecodeSignals(const std::string& aText, std::vector<SignalMessage>& aSignals)
+{
+  SignalDecoder decoder;
+  const int count = decoder.decode(aText.data(), aText.length());
+  if (count <= 0) {
+    return false;
+  }
+  aSignals.assign(count, SignalMessage());
+  for (int ix = 0; ix < count; ix++) {
+    aSignals[ix] = decoder.message(ix);
+  }
+  return true;
+}
+
+// An object of aKeys integer members whose keys share a 9 byte prefix, so
+// a linear scan compares more than the first byte of each.
+static void
+MakeObject(int aKeys, Message& aMessage)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "object-%d", aKeys);
+  aMessage.name = name;
+  aMessage.text = "{";
+  for (int ix = 0; ix < aKeys; ix++) {
+    snprintf(name, sizeof(name), "signaling%04d", ix);
+    aMessage.keys.push_back(name);
+    aMessage.jsonKeys.push_back(JSONKey(aMessage.keys.back()));
+    aMessage.text += (ix ? ",\"" : "\"");
+    aMessage.text += aMessage.keys.back();
+    snprintf(name, sizeof(name), "\":%d", ix);
+    aMessage.text += name;
+  }
+  aMessage.text += "}";
+}
+
+static bool
+LoadMessage(const char* aPath, Message& aMessage)
+{
+  if (!ReadFile(aPath, aMessage.text)) {
+    return false;
+  }
+  const char* name = strrchr(aPath, '/');
+  aMessage.name = (name ? name + 1 : aPath);
+  const size_t dot = aMessage.name.rfind('.');
+  if (dot != std::string::npos) {
+    aMessage.name.erase(dot);
+  }
+
+  aMessage.delimited = aMessage.text + sTerminator;
+  const size_t length = aMessage.text.length();
+  aMessage.prefixed.clear();
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    aMessage.prefixed += (char)(length >> shift);
+  }
+  aMessage.prefixed += aMessage.text;
+  MaskFrame(aMessage.text, aMessage.webSocket);
+
+  std::vector<SignalMessage> signals;
+  CBORGenerator gen;
+  return DecodeSignals(aMessage.text, signals) &&
+         GenerateSignals(gen, signals, aMessage.text[0] == '[') &&
+         gen.getCBOR(aMessage.cbor);
+}
+
+// Fills aSignal the way the player's ExtractSignal does for CBOR.
+template<class Parser>
+static void
+ExtractSignal(Parser& aParse, int aElement, SignalMessage& aSignal)
+{
+  aSignal.clear();
+  if (aElement < 0) {
+    if (aParse.find("type", aSignal.type)) { aSignal.fields |= SignalMessage::FieldType; }
+    if (aParse.find("sdp", aSignal.sdp)) { aSignal.fields |= SignalMessage::FieldSdp; }
+    if (aParse.find("candidate", aSignal.candidate)) { aSignal.fields |= SignalMessage::FieldCandidate; }
+    if (aParse.find("sdpMid", aSignal.sdpMid)) { aSignal.fields |= SignalMessage::FieldSdpMid; }
+    if (aParse.find("sdpMLineIndex", aSignal.sdpMLineIndex)) { aSignal.fields |= SignalMessage::FieldSdpMLineIndex; }
+  }
+  else {
+    if (aParse.find(aElement, "type", aSignal.type)) { aSignal.fields |= SignalMessage::FieldType; }
+    if (aParse.find(aElement, "sdp", aSignal.sdp)) { aSignal.fields |= SignalMessage::FieldSdp; }
+    if (aParse.find(aElement, "candidate", aSignal.candidate)) { aSignal.fields |= SignalMessage::FieldCandidate; }
+    if (aParse.find(aElement, "sdpMid", aSignal.sdpMid)) { aSignal.fields |= SignalMessage::FieldSdpMid; }
+    if (aParse.find(aElement, "sdpMLineIndex", aSignal.sdpMLineIndex)) { aSignal.fields |= SignalMessage::FieldSdpMLineIndex; }
+  }
+}
+
+// Holds what the cases reuse between messages, as the player does between
+// messages on one connection.
+class Bench {
+public:
+  Bench() :
+    mGenerator(mOutput),
+    mCBORGenerator(mOutput),
+    mParsed(NULL),
+    mDecoded(NULL),
+    mFramer(sTerminator, sTerminatorSize),
+    mRandom(sSeed ? sSeed : 1),
+    mTree(NULL),
+    mTreeOf(NULL) {
+    mGen = yajl_gen_alloc(NULL);
+  }
+  ~Bench()
+  {
+    yajl_gen_free(mGen);
+    if (mTree) {
+      yajl_tree_free(mTree);
+    }
+  }
+
+  bool yajlTree(const Message& aMessage);
+  bool parse(const Message& aMessage);
+  bool decode(const Message& aMessage);
+  bool cborDecode(const Message& aMessage);
+  bool find(const Message& aMessage);
+  bool findKeysYajl(const Message& aMessage);
+  bool findKeysString(const Message& aMessage);
+  bool findKeysJSONKey(const Message& aMessage);
+  bool generate(const Message& aMessage);
+  bool cborGenerate(const Message& aMessage);
+  bool yajlGen(const Message& aMessage);
+  bool frameDelimited(const Message& aMessage);
+  bool framePrefixed(const Message& aMessage);
+  bool frameWebSocket(const Message& aMessage);
+  bool frameDelimitedRandom(const Message& aMessage);
+  bool framePrefixedRandom(const Message& aMessage);
+  bool frameWebSocketRandom(const Message& aMessage);
+  bool scanFind(const Message& aMessage);
+  bool scanPair(const Message& aMessage);
+  bool scanPairResume(const Message& aMessage);
+
+protected:
+  bool load(const Message& aMessage);
+  bool frame(Framer::Mode aMode, const std::string& aWire, bool aRandom);
+  bool scanReads(const std::string& aWire, bool aResume);
+  size_t randomRead();
+  void extract(int aElement);
+
+  JSONParser mParser;
+  SignalDecoder mDecoder;
+  FrameBuffer mOutput;
+  JSONGenerator mGenerator;
+  CBORGenerator mCBORGenerator;
+  yajl_gen mGen;
+  // Messages already parsed or decoded, for the cases that start from them.
+  const Message* mParsed;
+  JSONParser mSource;
+  const Message* mDecoded;
+  std::vector<SignalMessage> mSignals;
+  SignalMessage mSignal;
+  Framer mFramer;
+  FrameBuffer mBatch;
+  uint32_t mRandom;
+  std::string mMessage;
+  yajl_val mTree;
+  const Message* mTreeOf;
+};
+
+bool
+Bench::yajlTree(const Message& aMessage)
+{
+  yajl_val node = yajl_tree_parse(aMessage.text.c_str(), NULL, 0);
+  if (!node) {
+    return false;
+  }
+  yajl_tree_free(node);
+  return true;
+}
+
+bool
+Bench::parse(const Message& aMessage)
+{
+  return mParser.parse(aMessage.text.c_str());
+}
+
+bool
+Bench::decode(const Message& aMessage)
+{
+  return mDecoder.decode(aMessage.text.data(), aMessage.text.length()) > 0;
+}
+
+// Reads every field of the CBOR encoding into mSignal, as HandleMessage does
+// for a CBOR connection. bytes and ns_per_byte still count the JSON text,
+// so the line compares with decode's.
+bool
+Bench::cborDecode(const Message& aMessage)
+{
+  CBORParser parse(aMessage.cbor.data(), aMessage.cbor.length());
+  const int count = parse.length();
+  for (int element = 0; element < count; element++) {
+    ExtractSignal(parse, element, mSignal);
+  }
+  if (count == 0) {
+    ExtractSignal(parse, -1, mSignal);
+  }
+  return mSignal.fields != 0;
+}
+
+// Fills mSignal the way the player's ExtractSignal does.
+void
+Bench::extract(int aElement)
+{
+  mSignal.clear();
+  if (aElement < 0) {
+    if (mSource.find(sTypeKey, mSignal.type)) { mSignal.fields |= SignalMessage::FieldType; }
+    if (mSource.find(sSdpKey, mSignal.sdp)) { mSignal.fields |= SignalMessage::FieldSdp; }
+    if (mSource.find(sCandidateKey, mSignal.candidate)) { mSignal.fields |= SignalMessage::FieldCandidate; }
+    if (mSource.find(sSdpMidKey, mSignal.sdpMid)) { mSignal.fields |= SignalMessage::FieldSdpMid; }
+    if (mSource.find(sSdpMLineIndexKey, mSignal.sdpMLineIndex)) { mSignal.fields |= SignalMessage::FieldSdpMLineIndex; }
+  }
+  else {
+    if (mSource.find(aElement, sTypeKey, mSignal.type)) { mSignal.fields |= SignalMessage::FieldType; }
+    if (mSource.find(aElement, sSdpKey, mSignal.sdp)) { mSignal.fields |= SignalMessage::FieldSdp; }
+    if (mSource.find(aElement, sCandidateKey, mSignal.candidate)) { mSignal.fields |= SignalMessage::FieldCandidate; }
+    if (mSource.find(aElement, sSdpMidKey, mSignal.sdpMid)) { mSignal.fields |= SignalMessage::FieldSdpMid; }
+    if (mSource.find(aElement, sSdpMLineIndexKey, mSignal.sdpMLineIndex)) { mSignal.fields |= SignalMessage::FieldSdpMLineIndex; }
+  }
+}
+
+// Only the lookups are timed. The message is parsed on the first, untimed,
+// run.
+bool
+Bench::find(const Message& aMessage)
+{
+  if (mParsed != &aMessage) {
+    if (!mSource.parse(aMessage.text.c_str())) {
+      return false;
+    }
+    mParsed = &aMessage;
+  }
+  const int count = mSource.length();
+  for (int element = 0; element < count; element++) {
+    extract(element);
+  }
+  if (count == 0) {
+    extract(-1);
+  }
+  return mSignal.fields != 0;
+}
+
+// Looks up every key of a generated object, through yajl_tree_get as
+// JSONParser did before its key index, and through JSONParser with string
+// and precomputed keys. A run is one lookup of each key. Parsing happens on
+// the first, untimed, run.
+bool
+Bench::findKeysYajl(const Message& aMessage)
+{
+  if (mTreeOf != &aMessage) {
+    if (mTree) {
+      yajl_tree_free(mTree);
+    }
+    mTree = yajl_tree_parse(aMessage.text.c_str(), NULL, 0);
+    mTreeOf = &aMessage;
+  }
+  int found = 0;
+  for (size_t ix = 0; ix < aMessage.keys.size(); ix++) {
+    const char* path[] = { aMessage.keys[ix].c_str(), NULL };
+    found += (yajl_tree_get(mTree, path, yajl_t_number) != NULL);
+  }
+  return found == (int)aMessage.keys.size();
+}
+
+bool
+Bench::findKeysString(const Message& aMessage)
+{
+  if (mParsed != &aMessage) {
+    if (!mSource.parse(aMessage.text.c_str())) {
+      return false;
+    }
+    mParsed = &aMessage;
+  }
+  int found = 0;
+  int value = 0;
+  for (size_t ix = 0; ix < aMessage.keys.size(); ix++) {
+    found += mSource.find(aMessage.keys[ix], value);
+  }
+  return found == (int)aMessage.keys.size();
+}
+
+bool
+Bench::findKeysJSONKey(const Message& aMessage)
+{
+  if (mParsed != &aMessage) {
+    if (!mSource.parse(aMessage.text.c_str())) {
+      return false;
+    }
+    mParsed = &aMessage;
+  }
+  int found = 0;
+  int value = 0;
+  for (size_t ix = 0; ix < aMessage.jsonKeys.size(); ix++) {
+    found += mSource.find(aMessage.jsonKeys[ix], value);
+  }
+  return found == (int)aMessage.jsonKeys.size();
+}
+
+// Decodes the fields the generating cases write out, on their first,
+// untimed, run.
+bool
+Bench::load(const Message& aMessage)
+{
+  if (mDecoded == &aMessage) {
+    return true;
+  }
+  if (!DecodeSignals(aMessage.text, mSignals)) {
+    return false;
+  }
+  mDecoded = &aMessage;
+  return true;
+}
+
+// Writes the message back out from its decoded fields, as the player writes
+// answers and candidates.
+bool
+Bench::generate(const Message& aMessage)
+{
+  if (!load(aMessage)) {
+    return false;
+  }
+
+  mOutput.clear();
+  mGenerator.clear();
+  return GenerateSignals(mGenerator, mSignals, aMessage.text[0] == '[') && (mOutput.length() > 0);
+}
+
+// The CBOR encoding of the same fields, into the same reused buffer.
+bool
+Bench::cborGenerate(const Message& aMessage)
+{
+  if (!load(aMessage)) {
+    return false;
+  }
+
+  mOutput.clear();
+  mCBORGenerator.clear();
+  return GenerateSignals(mCBORGenerator, mSignals, aMessage.text[0] == '[') && (mOutput.length() > 0);
+}
+
+// The same message through yajl_gen alone, into its own buffer.
+bool
+Bench::yajlGen(const Message& aMessage)
+{
+  if (!load(aMessage)) {
+    return false;
+  }
+
+  yajl_gen_clear(mGen);
+  yajl_gen_reset(mGen, NULL);
+  const bool batch = (aMessage.text[0] == '[');
+  if (batch) {
+    yajl_gen_array_open(mGen);
+  }
+  for (size_t ix = 0; ix < mSignals.size(); ix++) {
+    const SignalMessage& signal = mSignals[ix];
+    yajl_gen_map_open(mGen);
+    if (signal.has(SignalMessage::FieldType)) {
+      yajl_gen_string(mGen, (const unsigned char*)"type", 4);
+      yajl_gen_string(mGen, (const unsigned char*)signal.type.data(), signal.type.length());
+      yajl_gen_string(mGen, (const unsigned char*)"sdp", 3);
+      yajl_gen_string(mGen, (const unsigned char*)signal.sdp.data(), signal.sdp.length());
+    }
+    else {
+      yajl_gen_string(mGen, (const unsigned char*)"candidate", 9);
+      yajl_gen_string(mGen, (const unsigned char*)signal.candidate.data(), signal.candidate.length());
+      yajl_gen_string(mGen, (const unsigned char*)"sdpMid", 6);
+      yajl_gen_string(mGen, (const unsigned char*)signal.sdpMid.data(), signal.sdpMid.length());
+      yajl_gen_string(mGen, (const unsigned char*)"sdpMLineIndex", 13);
+      yajl_gen_integer(mGen, signal.sdpMLineIndex);
+    }
+    yajl_gen_map_close(mGen);
+  }
+  if (batch) {
+    yajl_gen_array_close(mGen);
+  }
+  const unsigned char* buffer = NULL;
+  size_t length = 0;
+  return (yajl_gen_get_buf(mGen, &buffer, &length) == yajl_gen_status_ok) && (length > 0);
+}
+
+// A read length for the _random cases. One read in four is at most 16
+// bytes, so the cut often falls inside a terminator or header.
+size_t
+Bench::randomRead()
+{
+  mRandom ^= mRandom << 13;
+  mRandom ^= mRandom >> 17;
+  mRandom ^= mRandom << 5;
+  if ((mRandom & 3) == 0) {
+    return 1 + (mRandom >> 2) % 16;
+  }
+  return 1 + (mRandom >> 2) % (2 * sReadSize);
+}
+
+// Reads aWire in segments as SocketHandler::OnSocketReady does, takes the
+// message with next() and hands the buffer over as SocketHandler::Publish
+// does, getting the previous one back.
+bool
+Bench::frame(Framer::Mode aMode, const std::string& aWire, bool aRandom)
+{
+  mFramer.setMode(aMode);
+  mFramer.markCycle();
+  const char* wire = aWire.data();
+  size_t left = aWire.length();
+  FrameSlice slice;
+  bool found = false;
+  while (left > 0) {
+    size_t available = 0;
+    char* buffer = mFramer.reserve(available);
+    if (!buffer) {
+      return false;
+    }
+    const size_t size = (aRandom ? randomRead() : sReadSize);
+    const size_t read = (left < size ? left : size);
+    if (available > read) {
+      available = read;
+    }
+    memcpy(buffer, wire, available);
+    mFramer.commit(available);
+    wire += available;
+    left -= available;
+    while (mFramer.next(slice)) {
+      found = true;
+    }
+  }
+  if (!found || mFramer.failed()) {
+    return false;
+  }
+  mBatch.clear();
+  mFramer.detach(mBatch);
+  return mFramer.pending() == 0;
+}
+
+bool
+Bench::frameDelimited(const Message& aMessage)
+{
+  return frame(Framer::FrameDelimited, aMessage.delimited, false);
+}
+
+bool
+Bench::framePrefixed(const Message& aMessage)
+{
+  return frame(Framer::FramePrefixed, aMessage.prefixed, false);
+}
+
+bool
+Bench::frameWebSocket(const Message& aMessage)
+{
+  return frame(Framer::FrameWebSocket, aMessage.webSocket, false);
+}
+
+bool
+Bench::frameDelimitedRandom(const Message& aMessage)
+{
+  return frame(Framer::FrameDelimited, aMessage.delimited, true);
+}
+
+bool
+Bench::framePrefixedRandom(const Message& aMessage)
+{
+  return frame(Framer::FramePrefixed, aMessage.prefixed, true);
+}
+
+bool
+Bench::frameWebSocketRandom(const Message& aMessage)
+{
+  return frame(Framer::FrameWebSocket, aMessage.webSocket, true);
+}
+
+// The terminator search SocketHandler did before scan::FindPair: each read
+// is appended to a string and std::string::find starts over from the front.
+bool
+Bench::scanFind(const Message& aMessage)
+{
+  static const std::string term(sTerminator);
+  const std::string& wire = aMessage.delimited;
+  size_t found = 0;
+  mMessage.clear();
+  for (size_t at = 0; at < wire.length(); at += sReadSize) {
+    mMessage.append(wire, at, sReadSize);
+    size_t start = 0;
+    size_t end = mMessage.find(term);
+    while (end != std::string::npos) {
+      found++;
+      start = end + sTerminatorSize;
+      end = mMessage.find(term, start);
+    }
+    if (start > 0) {
+      mMessage.erase(0, start);
+    }
+  }
+  return found == 1;
+}
+
+// Finds the terminator with scan::FindPair as the reads arrive, either
+// rescanning everything received so far or resuming where the last scan
+// stopped, as Framer does.
+bool
+Bench::scanReads(const std::string& aWire, bool aResume)
+{
+  const char* data = aWire.data();
+  size_t found = 0;
+  size_t start = 0;
+  size_t scanned = 0;
+  for (size_t length = 0; length < aWire.length();) {
+    length += sReadSize;
+    if (length > aWire.length()) {
+      length = aWire.length();
+    }
+    size_t at = (aResume ? scanned : start);
+    while ((at + sTerminatorSize) <= length) {
+      at += scan::FindPair(data + at, length - at, sTerminator[0], sTerminator[1]);
+      if ((at + sTerminatorSize) > length) {
+        break;
+      }
+      found++;
+      at += sTerminatorSize;
+      start = at;
+    }
+    // A terminator may straddle the read, so its first byte is scanned again.
+    scanned = (length > start + 1 ? length - 1 : start);
+  }
+  return found == 1;
+}
+
+bool
+Bench::scanPair(const Message& aMessage)
+{
+  return scanReads(aMessage.delimited, false);
+}
+
+bool
+Bench::scanPairResume(const Message& aMessage)
+{
+  return scanReads(aMessage.delimited, true);
+}
+
+typedef bool (Bench::*Step)(const Message& aMessage);
+
+struct Case {
+  const char* name;
+  Step step;
+  // Runs over the generated objects instead of the corpus.
+  bool objects;
+};
+
+static const Case sCases[] = {
+  { "yajl_tree", &Bench::yajlTree, false },
+  { "parse", &Bench::parse, false },
+  { "decode", &Bench::decode, false },
+  { "cbor_decode", &Bench::cborDecode, false },
+  { "find", &Bench::find, false },
+  { "find_keys_yajl", &Bench::findKeysYajl, true },
+  { "find_keys_string", &Bench::findKeysString, true },
+  { "find_keys_jsonkey", &Bench::findKeysJSONKey, true },
+  { "generate", &Bench::generate, false },
+  { "cbor_generate", &Bench::cborGenerate, false },
+  { "yajl_gen", &Bench::yajlGen, false },
+  { "frame_delimited", &Bench::frameDelimited, false },
+  { "frame_prefixed", &Bench::framePrefixed, false },
+  { "frame_websocket", &Bench::frameWebSocket, false },
+  { "frame_delimited_random", &Bench::frameDelimitedRandom, false },
+  { "frame_prefixed_random", &Bench::framePrefixedRandom, false },
+  { "frame_websocket_random", &Bench::frameWebSocketRandom, false },
+  { "scan_find", &Bench::scanFind, false },
+  { "scan_pair", &Bench::scanPair, false },
+  { "scan_pair_resume", &Bench::scanPairResume, false }
+};
+
+static const char*
+ParserName()
+{
+#if defined(JSON_TAPE_PARSER)
+  static std::string name = std::string("tape-") + tape::Implementation();
+  return name.c_str();
+#else
+  return "yajl";
+#endif
+}
+
+// Runs aCase on aMessage for at least aSeconds, doubling the number of runs
+// between clock reads, and prints the result.
+static bool
+Run(Bench& aBench, const Case& aCase, const Message& aMessage, double aSeconds)
+{
+  // Warm up, so buffers that are kept have grown to size.
+  for (int ix = 0; ix < 4; ix++) {
+    if (!(aBench.*aCase.step)(aMessage)) {
+      fprintf(stderr, "%s failed on %s\n", aCase.name, aMessage.name.c_str());
+      return false;
+    }
+  }
+
+  unsigned long long runs = 0;
+  unsigned long long batch = 1;
+  const unsigned long long allocations = sAllocations;
+  const double start = Now();
+  double elapsed = 0;
+  do {
+    for (unsigned long long ix = 0; ix < batch; ix++) {
+      (aBench.*aCase.step)(aMessage);
+    }
+    runs += batch;
+    batch *= 2;
+    elapsed = Now() - start;
+  } while (elapsed < aSeconds);
+
+  const double bytes = (double)aMessage.text.length();
+  printf("{\"case\":\"%s\",\"message\":\"%s\",\"parser\":\"%s\",\"bytes\":%u,\"runs\":%llu,"
+         "\"messages_per_s\":%.1f,\"bytes_per_s\":%.0f,\"ns_per_byte\":%.3f,\"allocations_per_message\":%.2f}\n",
+         aCase.name, aMessage.name.c_str(), ParserName(), (unsigned int)bytes, runs,
+         runs / elapsed, runs * bytes / elapsed, elapsed * 1e9 / (runs * bytes),
+         (double)(sAllocations - allocations) / runs);
+  return true;
+}
+
+static void
+Usage()
+{
+  fprintf(stderr, "usage: jsonbench [-t seconds] [-c case] [-s seed] message.json...\n");
+}
+
+int
+main(int argc, char** argv)
+{
+  double seconds = 0.2;
+  const char* only = NULL;
+  std::vector<Message> messages;
+
+  for (int ix = 1; ix < argc; ix++) {
+    if ((strcmp(argv[ix], "-t") == 0) && (ix + 1 < argc)) {
+      seconds = atof(argv[++ix]);
+    }
+    else if ((strcmp(argv[ix], "-c") == 0) && (ix + 1 < argc)) {
+      only = argv[++ix];
+    }
+    else if ((strcmp(argv[ix], "-s") == 0) && (ix + 1 < argc)) {
+      sSeed = (uint32_t)strtoul(argv[++ix], NULL, 0);
+    }
+    else if (argv[ix][0] == '-') {
+      Usage();
+      return 1;
+    }
+    else {
+      messages.push_back(Message());
+      if (!LoadMessage(argv[ix], messages.back())) {
+        fprintf(stderr, "Unable to read %s\n", argv[ix]);
+        return 1;
+      }
+    }
+  }
+  if (messages.empty()) {
+    Usage();
+    return 1;
+  }
+
+  std::vector<Message> objects(sizeof(sObjectSizes) / sizeof(sObjectSizes[0]));
+  for (size_t ix = 0; ix < objects.size(); ix++) {
+    MakeObject(sObjectSizes[ix], objects[ix]);
+  }
+
+  Bench bench;
+  bool ok = true;
+  for (size_t cs = 0; cs < sizeof(sCases) / sizeof(sCases[0]); cs++) {
+    if (only && strcmp(only, sCases[cs].name)) {
+      continue;
+    }
+    const std::vector<Message>& inputs = (sCases[cs].objects ? objects : messages);
+    for (size_t ix = 0; ix < inputs.size(); ix++) {
+      ok = Run(bench, sCases[cs], inputs[ix], seconds) && ok;
+    }
+  }
+  return ok ? 0 : 1;
+}
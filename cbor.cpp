@@ -0,0 +1,514 @@
+#include "cbor.h"
+
+#include <string.h>
+
+#include "framer.h"
+
+namespace {
+
+const unsigned char MajorUnsigned = 0;
+const unsigned char MajorNegative = 1;
+const unsigned char MajorBytes = 2;
+const unsigned char MajorText = 3;
+const unsigned char MajorArray = 4;
+const unsigned char MajorMap = 5;
+const unsigned char MajorTag = 6;
+const unsigned char MajorSimple = 7;
+
+const unsigned char Indefinite = 31;
+const unsigned char Break = 0xff;
+const int MaxDepth = 32;
+
+struct Item {
+  unsigned char major;
+  unsigned long long value;
+  bool indefinite;
+};
+
+// Reads the head of the item at aPos.
+bool
+readHead(const unsigned char*& aPos, const unsigned char* aEnd, Item& aItem)
+{
+  if (aPos >= aEnd) {
+    return false;
+  }
+  const unsigned char initial = *aPos++;
+  aItem.major = initial >> 5;
+  const unsigned char info = initial & 0x1f;
+  aItem.indefinite = false;
+  if (info < 24) {
+    aItem.value = info;
+    return true;
+  }
+  if (info == Indefinite) {
+    aItem.indefinite = true;
+    aItem.value = 0;
+    return (aItem.major >= MajorBytes) && (aItem.major <= MajorMap);
+  }
+  if (info > 27) {
+    return false;
+  }
+  const size_t size = (size_t)1 << (info - 24);
+  if ((size_t)(aEnd - aPos) < size) {
+    return false;
+  }
+  aItem.value = 0;
+  for (size_t ix = 0; ix < size; ix++) {
+    aItem.value = (aItem.value << 8) | *aPos++;
+  }
+  return true;
+}
+
+// Steps over the item at aPos, including everything nested in it.
+bool
+skip(const unsigned char*& aPos, const unsigned char* aEnd, int aDepth)
+{
+  Item item;
+  if ((aDepth > MaxDepth) || !readHead(aPos, aEnd, item)) {
+    return false;
+  }
+  switch (item.major) {
+  case MajorUnsigned:
+  case MajorNegative:
+    return true;
+  case MajorBytes:
+  case MajorText:
+    if (item.indefinite) {
+      while ((aPos < aEnd) && (*aPos != Break)) {
+        if (!skip(aPos, aEnd, aDepth + 1)) {
+          return false;
+        }
+      }
+      return (aPos++ < aEnd);
+    }
+    if ((unsigned long long)(aEnd - aPos) < item.value) {
+      return false;
+    }
+    aPos += item.value;
+    return true;
+  case MajorArray:
+  case MajorMap: {
+    const unsigned long long count = (item.major == MajorMap ? 2 : 1) * item.value;
+    if (item.indefinite) {
+      while ((aPos < aEnd) && (*aPos != Break)) {
+        if (!skip(aPos, aEnd, aDepth + 1)) {
+          return false;
+        }
+      }
+      return (aPos++ < aEnd);
+    }
+    for (unsigned long long ix = 0; ix < count; ix++) {
+      if (!skip(aPos, aEnd, aDepth + 1)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  case MajorTag:
+    return skip(aPos, aEnd, aDepth + 1);
+  case MajorSimple:
+    return true;
+  }
+  return false;
+}
+
+// Finds the value stored under aKey in the map at aPos. Only definite
+// length text keys are compared, which is all the generator produces.
+const unsigned char*
+lookup(const unsigned char* aPos, const unsigned char* aEnd, const std::string& aKey)
+{
+  Item map;
+  if (!aPos || !readHead(aPos, aEnd, map) || (map.major != MajorMap)) {
+    return NULL;
+  }
+  for (unsigned long long ix = 0; map.indefinite || (ix < map.value); ix++) {
+    if (map.indefinite && ((aPos >= aEnd) || (*aPos == Break))) {
+      break;
+    }
+    const unsigned char* key = aPos;
+    Item head;
+    if (!readHead(key, aEnd, head)) {
+      return NULL;
+    }
+    const bool match = (head.major == MajorText) && !head.indefinite &&
+                       (head.value == aKey.length()) &&
+                       ((unsigned long long)(aEnd - key) >= head.value) &&
+                       (memcmp(key, aKey.data(), aKey.length()) == 0);
+    if (!skip(aPos, aEnd, 1)) {
+      return NULL;
+    }
+    if (match) {
+      return aPos;
+    }
+    if (!skip(aPos, aEnd, 1)) {
+      return NULL;
+    }
+  }
+  return NULL;
+}
+
+bool
+readString(const unsigned char* aPos, const unsigned char* aEnd, std::string& aValue)
+{
+  Item item;
+  if (!aPos || !readHead(aPos, aEnd, item) || (item.major != MajorText) || item.indefinite) {
+    return false;
+  }
+  if ((unsigned long long)(aEnd - aPos) < item.value) {
+    return false;
+  }
+  aValue.assign((const char*)aPos, (size_t)item.value);
+  return true;
+}
+
+bool
+readInt(const unsigned char* aPos, const unsigned char* aEnd, int& aValue)
+{
+  Item item;
+  if (!aPos || !readHead(aPos, aEnd, item) || (item.value > 0x7fffffffULL)) {
+    return false;
+  }
+  if (item.major == MajorUnsigned) {
+    aValue = (int)item.value;
+    return true;
+  }
+  if (item.major == MajorNegative) {
+    aValue = -1 - (int)item.value;
+    return true;
+  }
+  return false;
+}
+
+} // namespace
+
+CBORParser::CBORParser(const char* data, size_t length) :
+  mData((const unsigned char*)data),
+  mEnd((const unsigned char*)data + length),
+  mValid(false),
+  mLength(0),
+  mElement(NULL),
+  mElementIndex(0),
+  mMap(NULL),
+  mPairs(-1)
+{
+  const unsigned char* pos = mData;
+  Item array = Item();
+  const bool head = readHead(pos, mEnd, array);
+  if (head && (array.major == MajorArray) && array.indefinite) {
+    // Count the elements while checking them, so length() does not walk
+    // them again.
+    while ((pos < mEnd) && (*pos != Break) && skip(pos, mEnd, 1)) {
+      mLength++;
+    }
+    mValid = (pos < mEnd) && (*pos == Break) && ((pos + 1) == mEnd);
+    return;
+  }
+  pos = mData;
+  mValid = skip(pos, mEnd, 0) && (pos == mEnd);
+  if (mValid && (array.major == MajorArray)) {
+    mLength = (int)array.value;
+  }
+}
+
+bool
+CBORParser::isValid(std::string& error)
+{
+  if (!mValid) {
+    error = "Malformed CBOR message";
+  }
+  return mValid;
+}
+
+bool
+CBORParser::find(const std::string& key, std::string& value)
+{
+  return mValid && readString(this->value(mData, key), mEnd, value);
+}
+
+bool
+CBORParser::find(const std::string& key, int& value)
+{
+  return mValid && readInt(this->value(mData, key), mEnd, value);
+}
+
+int
+CBORParser::length()
+{
+  return mValid ? mLength : 0;
+}
+
+// Finds the value stored under aKey in the map at aMap. The keys of the map
+// are indexed on its first lookup, since every field of a message is looked
+// up in turn, most of them absent.
+const unsigned char*
+CBORParser::value(const unsigned char* aMap, const std::string& aKey)
+{
+  if (!aMap) {
+    return NULL;
+  }
+  if (aMap != mMap) {
+    indexMap(aMap);
+  }
+  if (mPairs < 0) {
+    return lookup(aMap, mEnd, aKey);
+  }
+  for (int ix = 0; ix < mPairs; ix++) {
+    if ((mKeys[ix].length == aKey.length()) && (memcmp(mKeys[ix].key, aKey.data(), aKey.length()) == 0)) {
+      return mKeys[ix].value;
+    }
+  }
+  return NULL;
+}
+
+// Leaves mPairs at -1 when the map is not one the index can hold.
+void
+CBORParser::indexMap(const unsigned char* aMap)
+{
+  mMap = aMap;
+  mPairs = -1;
+  Item map;
+  const unsigned char* pos = aMap;
+  if (!readHead(pos, mEnd, map) || (map.major != MajorMap)) {
+    mPairs = 0;
+    return;
+  }
+  int pairs = 0;
+  for (unsigned long long ix = 0; map.indefinite || (ix < map.value); ix++) {
+    if (map.indefinite && ((pos >= mEnd) || (*pos == Break))) {
+      break;
+    }
+    if (pairs == sMaxPairs) {
+      return;
+    }
+    const unsigned char* key = pos;
+    Item head;
+    if (!readHead(key, mEnd, head)) {
+      return;
+    }
+    // Only definite length text keys can match, as in lookup().
+    const bool text = (head.major == MajorText) && !head.indefinite && ((unsigned long long)(mEnd - key) >= head.value);
+    if (!skip(pos, mEnd, 1)) {
+      return;
+    }
+    mKeys[pairs].key = key;
+    mKeys[pairs].length = (text ? (size_t)head.value : (size_t)-1);
+    mKeys[pairs].value = pos;
+    if (!skip(pos, mEnd, 1)) {
+      return;
+    }
+    pairs++;
+  }
+  mPairs = pairs;
+}
+
+// Returns the start of element aIndex of the top level array. Elements are
+// read in order, a few keys each, so the walk resumes from the last element
+// found instead of starting over for every key.
+const unsigned char*
+CBORParser::element(int aIndex)
+{
+  const unsigned char* pos = mElement;
+  int ix = mElementIndex;
+  if (!pos || (aIndex < ix)) {
+    Item array;
+    pos = mData;
+    if ((aIndex < 0) || !readHead(pos, mEnd, array) || (array.major != MajorArray)) {
+      return NULL;
+    }
+    if (!array.indefinite && ((unsigned long long)aIndex >= array.value)) {
+      return NULL;
+    }
+    ix = 0;
+  }
+  for (; ix < aIndex; ix++) {
+    if ((pos >= mEnd) || (*pos == Break) || !skip(pos, mEnd, 1)) {
+      return NULL;
+    }
+  }
+  if ((pos >= mEnd) || (*pos == Break)) {
+    return NULL;
+  }
+  mElement = pos;
+  mElementIndex = aIndex;
+  return pos;
+}
+
+bool
+CBORParser::find(int index, const std::string& key, std::string& value)
+{
+  return mValid && readString(this->value(element(index), key), mEnd, value);
+}
+
+bool
+CBORParser::find(int index, const std::string& key, int& value)
+{
+  return mValid && readInt(this->value(element(index), key), mEnd, value);
+}
+
+CBORGenerator::CBORGenerator() :
+  mOutput(new FrameBuffer),
+  mOwnsOutput(true),
+  mFailed(false) {}
+
+CBORGenerator::CBORGenerator(FrameBuffer& output) :
+  mOutput(&output),
+  mOwnsOutput(false),
+  mFailed(false) {}
+
+CBORGenerator::~CBORGenerator()
+{
+  if (mOwnsOutput) {
+    delete mOutput;
+  }
+  mOutput = NULL;
+}
+
+void
+CBORGenerator::clear()
+{
+  if (mOwnsOutput) {
+    mOutput->clear();
+  }
+  mFailed = false;
+}
+
+void
+CBORGenerator::add(const char* data, size_t length)
+{
+  size_t available = 0;
+  char* buffer = mOutput->reserve(length, available);
+  if (!buffer) {
+    mFailed = true;
+    return;
+  }
+  memcpy(buffer, data, length);
+  mOutput->commit(length);
+}
+
+void
+CBORGenerator::addHead(unsigned char major, unsigned long long value)
+{
+  char head[5];
+  size_t size = 0;
+  major <<= 5;
+  if (value < 24) {
+    head[size++] = (char)(major | value);
+  }
+  else if (value <= 0xff) {
+    head[size++] = (char)(major | 24);
+    head[size++] = (char)value;
+  }
+  else if (value <= 0xffff) {
+    head[size++] = (char)(major | 25);
+    head[size++] = (char)(value >> 8);
+    head[size++] = (char)value;
+  }
+  else {
+    head[size++] = (char)(major | 26);
+    head[size++] = (char)(value >> 24);
+    head[size++] = (char)(value >> 16);
+    head[size++] = (char)(value >> 8);
+    head[size++] = (char)value;
+  }
+  add(head, size);
+}
+
+void
+CBORGenerator::addString(const char* data, size_t length)
+{
+  addHead(MajorText, length);
+  add(data, length);
+}
+
+void
+CBORGenerator::addInteger(int value)
+{
+  if (value < 0) {
+    addHead(MajorNegative, (unsigned long long)(-1 - (long long)value));
+  }
+  else {
+    addHead(MajorUnsigned, (unsigned long long)value);
+  }
+}
+
+bool
+CBORGenerator::openMap()
+{
+  const char head = (char)((MajorMap << 5) | Indefinite);
+  add(&head, 1);
+  return !mFailed;
+}
+
+bool
+CBORGenerator::closeMap()
+{
+  const char head = (char)Break;
+  add(&head, 1);
+  return !mFailed;
+}
+
+bool
+CBORGenerator::openArray()
+{
+  const char head = (char)((MajorArray << 5) | Indefinite);
+  add(&head, 1);
+  return !mFailed;
+}
+
+bool
+CBORGenerator::closeArray()
+{
+  const char head = (char)Break;
+  add(&head, 1);
+  return !mFailed;
+}
+
+bool
+CBORGenerator::addPair(const std::string& key, const std::string& value)
+{
+  addString(key.data(), key.length());
+  addString(value.data(), value.length());
+  return !mFailed;
+}
+
+bool
+CBORGenerator::addPair(const char* key, const std::string& value)
+{
+  addString(key, strlen(key));
+  addString(value.data(), value.length());
+  return !mFailed;
+}
+
+bool
+CBORGenerator::addPair(const char* key, const char* value)
+{
+  addString(key, strlen(key));
+  addString(value, strlen(value));
+  return !mFailed;
+}
+
+bool
+CBORGenerator::addPair(const std::string& key, const int value)
+{
+  addString(key.data(), key.length());
+  addInteger(value);
+  return !mFailed;
+}
+
+bool
+CBORGenerator::addPair(const char* key, const int value)
+{
+  addString(key, strlen(key));
+  addInteger(value);
+  return !mFailed;
+}
+
+bool
+CBORGenerator::getCBOR(std::string& value)
+{
+  if (!mOwnsOutput || mFailed) {
+    return false;
+  }
+  value.assign(mOutput->data(), mOutput->length());
+  return true;
+}
@@ -0,0 +1,90 @@
+#ifndef CBOR_DOT_H
+#define CBOR_DOT_H
+
+#include <stddef.h>
+#include <string>
+
+// Minimal CBOR (RFC 7049) decoding of the signaling messages. Offers,
+// answers and candidates are maps of text strings and integers, optionally
+// batched in an array, so this mirrors the JSONParser interface for them.
+class CBORParser {
+public:
+  CBORParser(const char* data, size_t length);
+
+  bool isValid(std::string& error);
+  bool find(const std::string& key, std::string& value);
+  bool find(const std::string& key, int& value);
+
+  int length();
+  bool find(int index, const std::string& key, std::string& value);
+  bool find(int index, const std::string& key, int& value);
+
+protected:
+  static const int sMaxPairs = 8;
+
+  const unsigned char* element(int index);
+  const unsigned char* value(const unsigned char* map, const std::string& key);
+  void indexMap(const unsigned char* map);
+
+  const unsigned char* mData;
+  const unsigned char* mEnd;
+  bool mValid;
+  int mLength;
+  // The last element element() found.
+  const unsigned char* mElement;
+  int mElementIndex;
+  // Keys of the map last searched, or -1 pairs when it has too many.
+  struct Pair {
+    const unsigned char* key;
+    size_t length;
+    const unsigned char* value;
+  };
+  const unsigned char* mMap;
+  int mPairs;
+  Pair mKeys[sMaxPairs];
+};
+
+class FrameBuffer;
+
+// Encodes the same shapes with indefinite length maps and arrays so they
+// can be written out as they are built. Like JSONGenerator, one made with
+// an output appends to it, and is meant to be kept for the connection and
+// cleared before each message, so encoding does not allocate once the
+// output has grown.
+class CBORGenerator {
+public:
+  CBORGenerator();
+  explicit CBORGenerator(FrameBuffer& output);
+  ~CBORGenerator();
+
+  // Starts over for the next message. The output is left to its owner.
+  void clear();
+
+  bool openMap();
+  bool closeMap();
+  bool openArray();
+  bool closeArray();
+  bool addPair(const std::string& key, const std::string& value);
+  bool addPair(const char* key, const std::string& value);
+  bool addPair(const char* key, const char* value);
+  bool addPair(const std::string& key, const int value);
+  bool addPair(const char* key, const int value);
+  // Fails for a generator with an output.
+  bool getCBOR(std::string& value);
+
+protected:
+  CBORGenerator(const CBORGenerator&);
+  CBORGenerator& operator=(const CBORGenerator&);
+
+  void add(const char* data, size_t length);
+  void addHead(unsigned char major, unsigned long long value);
+  void addString(const char* data, size_t length);
+  void addInteger(int value);
+
+  FrameBuffer* mOutput;
+  bool mOwnsOutput;
+  // Set when the output could not grow, until clear().
+  bool mFailed;
+};
+
+#endif // #define CBOR_DOT_H
@@ -0,0 +1,370 @@
+#include "framer.h"
+#include "scan.h"
+#include "websocket.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const size_t sMinimumRead = 2048;
+static const size_t sMaximumRead = 64 * 1024;
+
+FrameBuffer::FrameBuffer() : mData(NULL), mLength(0), mCapacity(0) {}
+
+FrameBuffer::~FrameBuffer()
+{
+  free(mData); mData = NULL;
+}
+
+char*
+FrameBuffer::reserve(size_t aMinimum, size_t& aAvailable)
+{
+  if ((mCapacity - mLength) < aMinimum) {
+    size_t capacity = (mCapacity ? mCapacity : aMinimum);
+    while ((capacity - mLength) < aMinimum) {
+      capacity *= 2;
+    }
+    char* data = (char*)realloc(mData, capacity);
+    if (!data) {
+      aAvailable = 0;
+      return NULL;
+    }
+    mData = data;
+    mCapacity = capacity;
+  }
+  aAvailable = mCapacity - mLength;
+  return mData + mLength;
+}
+
+void
+FrameBuffer::swap(FrameBuffer& aOther)
+{
+  char* data = mData;
+  size_t length = mLength;
+  size_t capacity = mCapacity;
+  mData = aOther.mData;
+  mLength = aOther.mLength;
+  mCapacity = aOther.mCapacity;
+  aOther.mData = data;
+  aOther.mLength = length;
+  aOther.mCapacity = capacity;
+}
+
+Framer::Framer(const char* aTerminator, size_t aTerminatorSize) :
+  mMode(FrameDelimited),
+  mFailed(false),
+  mTerminator(aTerminator),
+  mTerminatorSize(aTerminatorSize),
+  mConsumed(0),
+  mScanned(0),
+  mExpected(sMinimumRead),
+  mCycles(0),
+  mStash(0),
+  mStashed(false),
+  mControlAt(0),
+  mControlSize(0),
+  mControlNext(0) {}
+
+char*
+Framer::reserve(size_t& aAvailable)
+{
+  removeControl();
+  // Nothing left to hand out, so start over at the front of the buffer.
+  if (mConsumed && (mConsumed == mBuffer.length())) {
+    mBuffer.clear();
+    mConsumed = 0;
+    mScanned = 0;
+    mStashed = false;
+  }
+
+  // Size the read so a typical message, or the prefixed message already
+  // under way, arrives in one go.
+  size_t expected = mExpected + mTerminatorSize;
+  if ((mMode == FramePrefixed) && (pending() >= sPrefixSize)) {
+    expected = prefixedLength() + sPrefixSize;
+  }
+  else if (mMode == FrameWebSocket) {
+    const size_t length = webSocketLength();
+    if (length) {
+      expected = length;
+    }
+  }
+  size_t wanted = sMinimumRead;
+  if (expected > (pending() + wanted)) {
+    wanted = expected - pending();
+  }
+  if (wanted > sMaximumRead) {
+    wanted = sMaximumRead;
+  }
+  if ((mBuffer.length() + wanted) > sMaximumBuffer) {
+    wanted = sMaximumBuffer - mBuffer.length();
+    if (wanted == 0) {
+      aAvailable = 0;
+      return NULL;
+    }
+  }
+  // Always leave one spare byte past the data for a trailing NUL.
+  char* result = mBuffer.reserve(wanted + 1, aAvailable);
+  if (result && (aAvailable > wanted)) {
+    aAvailable = wanted;
+  }
+  return result;
+}
+
+void
+Framer::discard(size_t aLength)
+{
+  if (aLength > pending()) {
+    aLength = pending();
+  }
+  mConsumed += aLength;
+  if (mScanned < mConsumed) {
+    mScanned = mConsumed;
+  }
+}
+
+void
+Framer::markCycle()
+{
+  if (pending() == 0) {
+    mCycles = 1;
+  }
+  else {
+    mCycles++;
+  }
+}
+
+bool
+Framer::next(FrameSlice& aSlice)
+{
+  removeControl();
+  if (mFailed) {
+    return false;
+  }
+  if (mMode == FramePrefixed) {
+    return nextPrefixed(aSlice);
+  }
+  if (mMode == FrameWebSocket) {
+    return nextWebSocket(aSlice);
+  }
+  return nextDelimited(aSlice);
+}
+
+bool
+Framer::nextDelimited(FrameSlice& aSlice)
+{
+  char* data = mBuffer.data();
+  const size_t length = mBuffer.length();
+
+  // Bytes before mScanned are known not to start a terminator, so a partial
+  // message is never rescanned when more of it arrives.
+  while ((mScanned + mTerminatorSize) <= length) {
+    size_t found = mScanned + scan::FindPair(data + mScanned, length - mScanned, mTerminator[0], mTerminator[1]);
+    if ((found + mTerminatorSize) > length) {
+      break;
+    }
+    if (memcmp(data + found + 2, mTerminator + 2, mTerminatorSize - 2) == 0) {
+      complete(aSlice, mConsumed, found - mConsumed, found + mTerminatorSize);
+      return true;
+    }
+    mScanned = found + 1;
+  }
+  if ((length - mScanned) >= mTerminatorSize) {
+    mScanned = length - (mTerminatorSize - 1);
+  }
+  return false;
+}
+
+size_t
+Framer::prefixedLength() const
+{
+  const unsigned char* prefix = (const unsigned char*)mBuffer.data() + mConsumed;
+  const unsigned char first = (mStashed ? (unsigned char)mStash : prefix[0]);
+  return ((size_t)first << 24) | ((size_t)prefix[1] << 16) | ((size_t)prefix[2] << 8) | (size_t)prefix[3];
+}
+
+bool
+Framer::nextPrefixed(FrameSlice& aSlice)
+{
+  if (pending() < sPrefixSize) {
+    return false;
+  }
+  const size_t length = prefixedLength();
+  if (pending() < (sPrefixSize + length)) {
+    return false;
+  }
+  mStashed = false;
+  const size_t end = mConsumed + sPrefixSize + length;
+  if (end < mBuffer.length()) {
+    mStash = mBuffer.data()[end];
+    mStashed = true;
+  }
+  complete(aSlice, mConsumed + sPrefixSize, length, end);
+  return true;
+}
+
+// Size of the frame at the front of the pending data, zero until its header
+// has arrived.
+size_t
+Framer::webSocketLength() const
+{
+  websocket::FrameHeader header;
+  const char* data = mBuffer.data() + mConsumed;
+  if (!pending() || !websocket::ParseHeader(data, pending(), (mStashed ? mStash : data[0]), header) ||
+      (header.length > sMaximumBuffer)) {
+    return 0;
+  }
+  return header.size + (size_t)header.length;
+}
+
+bool
+Framer::nextWebSocket(FrameSlice& aSlice)
+{
+  char* data = mBuffer.data();
+  const size_t length = mBuffer.length();
+
+  // Nothing is unmasked or moved until every fragment of the message is
+  // here, so a partial message is simply parsed again next time.
+  websocket::FrameHeader header;
+  size_t at = mConsumed;
+  size_t first = 0;
+  size_t total = 0;
+  uint8_t opcode = websocket::OpContinuation;
+  while (true) {
+    if ((at >= length) || !websocket::ParseHeader(data + at, length - at, (((at == mConsumed) && mStashed) ? mStash : data[at]), header)) {
+      return false;
+    }
+    const bool control = (header.opcode & 0x08) != 0;
+    // Clients always mask. Control frames are short and never fragmented,
+    // but may come between the fragments of a message.
+    if (!header.masked || (header.length > sMaximumBuffer) ||
+        (control && (!header.fin || (header.length > 125))) ||
+        (!control && ((at == mConsumed) == (header.opcode == websocket::OpContinuation)))) {
+      return fail();
+    }
+    if ((length - at - header.size) < header.length) {
+      return false;
+    }
+    if (control && (at != mConsumed)) {
+      return nextControl(aSlice, at, header);
+    }
+    if (at == mConsumed) {
+      first = at + header.size;
+      opcode = header.opcode;
+    }
+    at += header.size + (size_t)header.length;
+    total += (size_t)header.length;
+    if (header.fin) {
+      break;
+    }
+  }
+
+  // Unmask each fragment and slide it down behind the previous one.
+  size_t frame = mConsumed;
+  size_t joined = 0;
+  while (joined < total) {
+    websocket::ParseHeader(data + frame, length - frame, (((frame == mConsumed) && mStashed) ? mStash : data[frame]), header);
+    char* payload = data + frame + header.size;
+    websocket::Unmask(payload, (size_t)header.length, header.mask, 0);
+    if (payload != (data + first + joined)) {
+      memmove(data + first + joined, payload, (size_t)header.length);
+    }
+    frame += header.size + (size_t)header.length;
+    joined += (size_t)header.length;
+  }
+
+  mStashed = false;
+  if (((first + total) == at) && (at < length)) {
+    mStash = data[at];
+    mStashed = true;
+  }
+  complete(aSlice, first, total, at);
+  aSlice.opcode = opcode;
+  return true;
+}
+
+// Returns the control frame at aAt, which follows the first fragments of a
+// message. Those stay where they are, and the frame is cut out from between
+// them by removeControl() once the caller is done with it.
+bool
+Framer::nextControl(FrameSlice& aSlice, size_t aAt, const websocket::FrameHeader& aHeader)
+{
+  char* data = mBuffer.data();
+  const size_t offset = aAt + aHeader.size;
+  websocket::Unmask(data + offset, (size_t)aHeader.length, aHeader.mask, 0);
+  mControlAt = aAt;
+  mControlSize = aHeader.size + (size_t)aHeader.length;
+  // reserve() always leaves room for the NUL past the data.
+  mControlNext = data[offset + (size_t)aHeader.length];
+  data[offset + (size_t)aHeader.length] = '\0';
+  aSlice.offset = offset;
+  aSlice.length = (size_t)aHeader.length;
+  aSlice.cycles = mCycles;
+  aSlice.opcode = aHeader.opcode;
+  return true;
+}
+
+void
+Framer::removeControl()
+{
+  if (!mControlSize) {
+    return;
+  }
+  char* data = mBuffer.data();
+  const size_t end = mControlAt + mControlSize;
+  data[end] = mControlNext;
+  memmove(data + mControlAt, data + end, mBuffer.length() - end);
+  mBuffer.truncate(mBuffer.length() - mControlSize);
+  mControlSize = 0;
+}
+
+bool
+Framer::fail()
+{
+  mFailed = true;
+  return false;
+}
+
+void
+Framer::complete(FrameSlice& aSlice, size_t aOffset, size_t aLength, size_t aEnd)
+{
+  // reserve() always leaves room for this byte past the data.
+  mBuffer.data()[aOffset + aLength] = '\0';
+  aSlice.offset = aOffset;
+  aSlice.length = aLength;
+  aSlice.cycles = mCycles;
+  aSlice.opcode = websocket::OpText;
+  mConsumed = aEnd;
+  mScanned = mConsumed;
+  // Follow the largest recent message, decaying slowly toward smaller ones.
+  if (aLength > mExpected) {
+    mExpected = aLength;
+  }
+  else {
+    mExpected -= (mExpected - aLength) / 8;
+  }
+  // Whatever follows arrived during this same poll cycle.
+  mCycles = 1;
+}
+
+void
+Framer::detach(FrameBuffer& aOut)
+{
+  removeControl();
+  const size_t remainder = pending();
+  mBuffer.swap(aOut);
+  mBuffer.clear();
+  if (remainder > 0) {
+    size_t available = 0;
+    char* buffer = mBuffer.reserve((remainder > sMinimumRead ? remainder : sMinimumRead) + 1, available);
+    if (buffer) {
+      memcpy(buffer, aOut.data() + mConsumed, remainder);
+      if (mStashed) {
+        buffer[0] = mStash;
+        mStashed = false;
+      }
+      mBuffer.commit(remainder);
+    }
+  }
+  mScanned -= mConsumed;
+  mConsumed = 0;
+}
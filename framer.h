@@ -0,0 +1,136 @@
+#ifndef FRAMER_DOT_H
+#define FRAMER_DOT_H
+
+#include <stddef.h>
+#include <vector>
+
+#include "websocket.h"
+
+// Contiguous byte buffer the signaling socket reads straight into.
+class FrameBuffer {
+public:
+  FrameBuffer();
+  ~FrameBuffer();
+
+  char* data() { return mData; }
+  const char* data() const { return mData; }
+  size_t length() const { return mLength; }
+  size_t capacity() const { return mCapacity; }
+
+  // Returns the free space at the end of the buffer, growing it so that at
+  // least aMinimum bytes are available.
+  char* reserve(size_t aMinimum, size_t& aAvailable);
+  void commit(size_t aLength) { mLength += aLength; }
+  // Drops everything past the first aLength bytes.
+  void truncate(size_t aLength) { mLength = aLength; }
+  void clear() { mLength = 0; }
+  void swap(FrameBuffer& aOther);
+
+protected:
+  FrameBuffer(const FrameBuffer&);
+  FrameBuffer& operator=(const FrameBuffer&);
+
+  char* mData;
+  size_t mLength;
+  size_t mCapacity;
+};
+
+// A complete message inside a FrameBuffer. The byte following it is
+// overwritten with a NUL so data() + offset may be used as a C string.
+struct FrameSlice {
+  size_t offset;
+  size_t length;
+  // Number of poll cycles it took the message to arrive.
+  unsigned int cycles;
+  // WebSocket opcode of the message, always text in the other modes.
+  unsigned char opcode;
+};
+
+typedef std::vector<FrameSlice> FrameSliceList;
+
+// Splits the inbound byte stream into messages. In FrameDelimited mode
+// messages end with aTerminator, which must be at least two bytes long. In
+// FramePrefixed mode each message follows a four byte big-endian length. In
+// FrameWebSocket mode messages are RFC 6455 client frames, unmasked in place
+// and with fragments joined in place, so the payload is still contiguous. A
+// control frame between the fragments of a message is returned where it
+// lies, ahead of that message, and must be handled before the next call.
+class Framer {
+public:
+  enum Mode {
+    FrameDelimited,
+    FramePrefixed,
+    FrameWebSocket
+  };
+
+  static const size_t sPrefixSize = 4;
+  // Most a connection may hold in either direction, unprocessed input here
+  // and unsent output in SignalWriter.
+  static const size_t sMaximumBuffer = 1024 * 1024;
+
+  Framer(const char* aTerminator, size_t aTerminatorSize);
+
+  Mode mode() const { return mMode; }
+  // Set once the peer breaks the framing rules. next() returns nothing more.
+  bool failed() const { return mFailed; }
+  void setMode(Mode aMode) { mMode = aMode; }
+  // Drops aLength bytes of pending data, such as a connection preamble.
+  // Only valid before next() has returned anything from the buffer.
+  void discard(size_t aLength);
+
+  // Space to read into, sized from recently observed messages. commit() the
+  // number of bytes actually read. Returns NULL once the buffer holds as
+  // much as it is allowed to.
+  char* reserve(size_t& aAvailable);
+  void commit(size_t aLength) { mBuffer.commit(aLength); }
+  // Call once per readable poll cycle, before reading.
+  void markCycle();
+
+  // Returns the next complete message, if any.
+  bool next(FrameSlice& aSlice);
+
+  // Moves the buffer holding every message returned by next() into aOut,
+  // which must be empty. Any partial message is carried over into a fresh
+  // buffer so the completed ones are never copied.
+  void detach(FrameBuffer& aOut);
+
+  // Start of the buffer the offsets returned by next() refer to, until the
+  // next detach().
+  const char* data() const { return mBuffer.data(); }
+  size_t pending() const { return mBuffer.length() - mConsumed; }
+  const char* pendingData() const { return mBuffer.data() + mConsumed; }
+
+protected:
+  bool nextDelimited(FrameSlice& aSlice);
+  bool nextPrefixed(FrameSlice& aSlice);
+  bool nextWebSocket(FrameSlice& aSlice);
+  bool nextControl(FrameSlice& aSlice, size_t aAt, const websocket::FrameHeader& aHeader);
+  void removeControl();
+  bool fail();
+  void complete(FrameSlice& aSlice, size_t aOffset, size_t aLength, size_t aEnd);
+  size_t prefixedLength() const;
+  size_t webSocketLength() const;
+
+  Mode mMode;
+  bool mFailed;
+  const char* mTerminator;
+  const size_t mTerminatorSize;
+  FrameBuffer mBuffer;
+  size_t mConsumed;
+  size_t mScanned;
+  size_t mExpected;
+  unsigned int mCycles;
+  // A prefixed or WebSocket message's NUL may land on the first byte of the
+  // following prefix or frame header, so that byte is kept here until the
+  // header is read.
+  char mStash;
+  bool mStashed;
+  // A control frame returned from between the fragments of a message. It
+  // is cut out of the buffer on the next call, with mControlNext put back
+  // where its NUL went.
+  size_t mControlAt;
+  size_t mControlSize;
+  char mControlNext;
+};
+
+#endif // #define FRAMER_DOT_H
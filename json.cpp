@@ -1,34 +1,390 @@
 #include "api/yajl_gen.h"
+#include "api/yajl_parse.h"
 #include "api/yajl_tree.h"
+#include "framer.h"
 #include "json.h"
-#include <sstream>
+#include "tape.h"
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
 
 #define VALIDATE_STATE() if(!mState) { return false; }
 
+// Bump allocator handed to yajl through yajl_alloc_funcs. Everything is
+// released at once by reset(), which keeps only the newest and largest
+// chunk, so a warmed up arena resets in constant time and never calls
+// malloc. Each block records its size so realloc can copy it.
+class Arena {
+public:
+  Arena() : mChunk(NULL) {
+    mFuncs.malloc = Malloc;
+    mFuncs.realloc = Realloc;
+    mFuncs.free = Free;
+    mFuncs.ctx = this;
+  }
+  ~Arena()
+  {
+    freeChunks(NULL);
+  }
+
+  yajl_alloc_funcs* funcs() { return &mFuncs; }
+
+  void reset()
+  {
+    if (mChunk) {
+      freeChunks(mChunk);
+      mChunk->used = 0;
+      mChunk->last = NULL;
+    }
+  }
+
+protected:
+  struct Chunk {
+    Chunk* next;
+    size_t size;
+    size_t used;
+    char* last;
+  };
+
+  static const size_t sFirstChunk = 4096;
+  static const size_t sAlign = sizeof(double) > sizeof(void*) ? sizeof(double) : sizeof(void*);
+
+  static size_t align(size_t size) { return (size + sAlign - 1) & ~(sAlign - 1); }
+  static size_t header() { return align(sizeof(Chunk)); }
+  static size_t& blockSize(void* ptr) { return *(size_t*)((char*)ptr - sAlign); }
+
+  // Frees every chunk older than aKeep, or all of them.
+  void freeChunks(Chunk* aKeep)
+  {
+    Chunk* chunk = (aKeep ? aKeep->next : mChunk);
+    while (chunk) {
+      Chunk* next = chunk->next;
+      free(chunk);
+      chunk = next;
+    }
+    if (aKeep) {
+      aKeep->next = NULL;
+    }
+    else {
+      mChunk = NULL;
+    }
+  }
+
+  void* allocate(size_t size)
+  {
+    const size_t needed = sAlign + align(size);
+    if (!mChunk || ((mChunk->size - mChunk->used) < needed)) {
+      size_t chunkSize = (mChunk ? mChunk->size * 2 : sFirstChunk);
+      while (chunkSize < needed) {
+        chunkSize *= 2;
+      }
+      Chunk* chunk = (Chunk*)malloc(header() + chunkSize);
+      if (!chunk) {
+        return NULL;
+      }
+      chunk->next = mChunk;
+      chunk->size = chunkSize;
+      chunk->used = 0;
+      chunk->last = NULL;
+      mChunk = chunk;
+    }
+    char* block = (char*)mChunk + header() + mChunk->used + sAlign;
+    mChunk->used += needed;
+    mChunk->last = block;
+    blockSize(block) = size;
+    return block;
+  }
+
+  void* resize(void* ptr, size_t size)
+  {
+    if (!ptr) {
+      return allocate(size);
+    }
+    const size_t old = blockSize(ptr);
+    // The newest block can simply grow into the rest of its chunk.
+    if (mChunk && (ptr == mChunk->last)) {
+      const size_t start = (char*)ptr - ((char*)mChunk + header());
+      if ((start + align(size)) <= mChunk->size) {
+        mChunk->used = start + align(size);
+        blockSize(ptr) = size;
+        return ptr;
+      }
+    }
+    void* result = allocate(size);
+    if (result) {
+      memcpy(result, ptr, (old < size ? old : size));
+    }
+    return result;
+  }
+
+  void release(void* ptr)
+  {
+    // Only the newest block can be given back before a reset.
+    if (ptr && mChunk && (ptr == mChunk->last)) {
+      mChunk->used = (char*)ptr - sAlign - ((char*)mChunk + header());
+      mChunk->last = NULL;
+    }
+  }
+
+  static void* Malloc(void* ctx, size_t size) { return ((Arena*)ctx)->allocate(size); }
+  static void* Realloc(void* ctx, void* ptr, size_t size) { return ((Arena*)ctx)->resize(ptr, size); }
+  static void Free(void* ctx, void* ptr) { ((Arena*)ctx)->release(ptr); }
+
+  Chunk* mChunk;
+  yajl_alloc_funcs mFuncs;
+};
+
+// Open addressing table over one object's keys.
+struct KeyIndex {
+  struct Slot {
+    uint32_t hash;
+    // Member index plus one, zero when empty.
+    uint32_t member;
+  };
+  yajl_val object;
+  size_t mask;
+  Slot* slots;
+};
+
+// The indexes built for one parsed tree. They live in the tree's arena and
+// are dropped along with it by clear().
+class KeyIndexCache {
+public:
+  KeyIndexCache(Arena& aArena) : mArena(aArena) {}
+  KeyIndex* get(yajl_val object);
+  void clear() { mIndexes.clear(); }
+
+protected:
+  Arena& mArena;
+  std::vector<KeyIndex*> mIndexes;
+};
+
+// Returns the index of a large object, building it on first use.
+KeyIndex*
+KeyIndexCache::get(yajl_val object)
+{
+  const size_t count = mIndexes.size();
+  for (size_t ix = 0; ix < count; ix++) {
+    if (mIndexes[ix]->object == object) {
+      return mIndexes[ix];
+    }
+  }
+
+  const size_t len = object->u.object.len;
+  size_t size = 16;
+  while (size < (len * 2)) {
+    size *= 2;
+  }
+  yajl_alloc_funcs* funcs = mArena.funcs();
+  KeyIndex* index = (KeyIndex*)funcs->malloc(funcs->ctx, sizeof(KeyIndex));
+  KeyIndex::Slot* slots = (KeyIndex::Slot*)funcs->malloc(funcs->ctx, sizeof(KeyIndex::Slot) * size);
+  if (!index || !slots) {
+    return NULL;
+  }
+  memset(slots, 0, sizeof(KeyIndex::Slot) * size);
+  index->object = object;
+  index->mask = size - 1;
+  index->slots = slots;
+  // Probing reaches keys in the order they went in, so inserting in member
+  // order finds the first of any duplicate keys, as a linear scan does.
+  for (size_t member = 1; member <= len; member++) {
+    const char* key = object->u.object.keys[member - 1];
+    const uint32_t hash = JSONKey::Hash(key, strlen(key));
+    size_t slot = hash & index->mask;
+    while (slots[slot].member) {
+      slot = (slot + 1) & index->mask;
+    }
+    slots[slot].hash = hash;
+    slots[slot].member = (uint32_t)member;
+  }
+  mIndexes.push_back(index);
+  return index;
+}
+
+#if defined(JSON_TAPE_PARSER)
+
+// Parsed by the two pass parser in tape.h instead of yajl_tree. Values are
+// tape positions.
+struct JSONParser::State {
+  typedef size_t Value;
+
+  tape::Parser mParser;
+  bool mValid;
+
+  State() : mValid(false) {}
+
+  bool parse(const char* data) { return finish(mParser.parse(data, strlen(data))); }
+  bool parseInPlace(char* data, size_t length) { return finish(mParser.parseInPlace(data, length)); }
+  bool finish(bool valid) { mValid = valid; return mValid; }
+  const std::string& error() const { return mParser.error(); }
+
+  Value root() const { return (mValid ? mParser.root() : 0); }
+  int length(Value array) const { return (mParser.isArray(array) ? (int)mParser.length(array) : 0); }
+  Value element(Value array, int index) const { return (index >= 0 ? mParser.element(array, (size_t)index) : 0); }
+  Value lookup(Value object, const char* key, size_t length, const uint32_t* hash)
+  {
+    return mParser.lookup(object, key, length, (hash ? *hash : JSONKey::Hash(key, length)));
+  }
+  bool string(Value value, const char*& data, size_t& length) const { return mParser.string(value, data, length); }
+  bool integer(Value value, int& result) const
+  {
+    long long number = 0;
+    if (!mParser.integer(value, number)) {
+      return false;
+    }
+    result = (int)number;
+    return true;
+  }
+};
+
+#else
+
+// Objects with at least this many keys get a hash index on their first
+// lookup. Below it a linear scan is as fast.
+static const size_t sIndexThreshold = 12;
+
+static yajl_val
+lookup(KeyIndexCache* indexes, yajl_val object, const char* key, size_t length, const uint32_t* hash)
+{
+  if (!YAJL_IS_OBJECT(object)) {
+    return NULL;
+  }
+  const size_t len = object->u.object.len;
+  if ((len < sIndexThreshold) || !indexes) {
+    for (size_t ix = 0; ix < len; ix++) {
+      if (strcmp(key, object->u.object.keys[ix]) == 0) {
+        return object->u.object.values[ix];
+      }
+    }
+    return NULL;
+  }
+
+  KeyIndex* index = indexes->get(object);
+  if (!index) {
+    return lookup(NULL, object, key, length, hash);
+  }
+  const uint32_t keyHash = (hash ? *hash : JSONKey::Hash(key, length));
+  for (size_t slot = keyHash & index->mask; index->slots[slot].member; slot = (slot + 1) & index->mask) {
+    if (index->slots[slot].hash == keyHash) {
+      const size_t member = index->slots[slot].member - 1;
+      if (strcmp(key, object->u.object.keys[member]) == 0) {
+        return object->u.object.values[member];
+      }
+    }
+  }
+  return NULL;
+}
+
+// The tree lives entirely in mArena, so it is never freed node by node.
 struct JSONParser::State {
+  typedef yajl_val Value;
+
   yajl_val mTree;
   bool mValid;
   std::string mError;
+  Arena mArena;
+  KeyIndexCache mIndexes;
 
-  State() : mTree(NULL), mValid(true) {};
-  ~State()
+  State() : mTree(NULL), mValid(false), mIndexes(mArena) {};
+
+  bool parse(const char* data)
   {
-    yajl_tree_free(mTree); mTree = NULL;
+    const int errorSize = 1024;
+    char error[errorSize];
+
+    reset();
+    mTree = yajl_tree_parse_alloc(data, mArena.funcs(), error, errorSize);
+    return finish(error);
+  }
+
+  bool parseInPlace(char* data, size_t length)
+  {
+    const int errorSize = 1024;
+    char error[errorSize];
+
+    reset();
+    mTree = yajl_tree_parse_in_place(data, length, mArena.funcs(), error, errorSize);
+    return finish(error);
+  }
+
+  // Clears the previous document before a parse.
+  void reset()
+  {
+    mArena.reset();
+    mIndexes.clear();
+  }
+
+  bool finish(const char* error)
+  {
+    mValid = (mTree != NULL);
+    if (mValid) {
+      mError.clear();
+    }
+    else {
+      mError = error;
+    }
+    return mValid;
+  }
+
+  const std::string& error() const { return mError; }
+
+  Value root() const { return mTree; }
+  int length(Value array) const { return (YAJL_IS_ARRAY(array) ? (int)array->u.array.len : 0); }
+  Value element(Value array, int index) const
+  {
+    if (YAJL_IS_ARRAY(array) && (index >= 0) && ((size_t)index < array->u.array.len)) {
+      return array->u.array.values[index];
+    }
+    return NULL;
+  }
+  Value lookup(Value object, const char* key, size_t length, const uint32_t* hash)
+  {
+    return ::lookup(&mIndexes, object, key, length, hash);
+  }
+  bool string(Value value, const char*& data, size_t& length) const
+  {
+    if (!YAJL_IS_STRING(value)) {
+      return false;
+    }
+    data = YAJL_GET_STRING(value);
+    length = strlen(data);
+    return true;
+  }
+  bool integer(Value value, int& result) const
+  {
+    if (!YAJL_IS_INTEGER(value)) {
+      return false;
+    }
+    result = (int)YAJL_GET_INTEGER(value);
+    return true;
   }
 };
 
+#endif
+
+JSONParser::JSONParser() : mState(NULL)
+{
+  mState = new State;
+}
+
 JSONParser::JSONParser(const char* data) : mState(NULL)
 {
-  const int errorSize = 1024;
-  char error[errorSize];
   mState = new State;
+  parse(data);
+}
 
-  mState->mTree = yajl_tree_parse(data, error, errorSize);
+bool
+JSONParser::parse(const char* data)
+{
+  VALIDATE_STATE();
+  return mState->parse(data);
+}
 
-  if (!mState->mTree) {
-    mState->mValid = false;
-    mState->mError = error;
-  }
+bool
+JSONParser::parseInPlace(char* data, size_t length)
+{
+  VALIDATE_STATE();
+  return mState->parseInPlace(data, length);
 }
 
 JSONParser::~JSONParser()
@@ -40,47 +396,557 @@ bool
 JSONParser::isValid(std::string& error)
 {
   VALIDATE_STATE();
-  error = mState->mError;
+  error = mState->error();
   return mState->mValid;
 }
 
+uint32_t
+JSONKey::Hash(const char* data, size_t length)
+{
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (size_t ix = 0; ix < length; ix++) {
+    hash = (hash ^ (unsigned char)data[ix]) * 16777619u;
+  }
+  return hash;
+}
+
+JSONKey::JSONKey(const char* name) :
+  mName(name),
+  mHash(Hash(mName.data(), mName.length())) {}
+
+JSONKey::JSONKey(const std::string& name) :
+  mName(name),
+  mHash(Hash(mName.data(), mName.length())) {}
+
+// Shared by both parsers through the interface of JSONParser::State.
+template<class Document>
+static bool
+findString(Document& document, typename Document::Value object, const char* key, size_t length, const uint32_t* hash, std::string& value)
+{
+  const char* str = NULL;
+  size_t strLength = 0;
+  if (!document.string(document.lookup(object, key, length, hash), str, strLength)) {
+    return false;
+  }
+  value.assign(str, strLength);
+  return true;
+}
+
+template<class Document>
+static bool
+findView(Document& document, typename Document::Value object, const char* key, size_t length, const uint32_t* hash, const char*& value, size_t& valueLength)
+{
+  return document.string(document.lookup(object, key, length, hash), value, valueLength);
+}
+
+template<class Document>
+static bool
+findInt(Document& document, typename Document::Value object, const char* key, size_t length, const uint32_t* hash, int& value)
+{
+  return document.integer(document.lookup(object, key, length, hash), value);
+}
+
 bool
 JSONParser::find(const std::string& key, std::string& value)
 {
   VALIDATE_STATE();
-  bool result = false;
+  return findString(*mState, mState->root(), key.c_str(), key.length(), NULL, value);
+}
 
-  if (mState->mTree) {
-    const char* path[2] = { key.c_str(), NULL };
-    yajl_val str = yajl_tree_get(mState->mTree, path, yajl_t_string);
-    if (str) {
-      result = true;
-      value = YAJL_GET_STRING(str);
-    }
+bool
+JSONParser::find(const std::string& key, int& value)
+{
+  VALIDATE_STATE();
+  return findInt(*mState, mState->root(), key.c_str(), key.length(), NULL, value);
+}
+
+bool
+JSONParser::find(const JSONKey& key, std::string& value)
+{
+  VALIDATE_STATE();
+  const uint32_t hash = key.hash();
+  return findString(*mState, mState->root(), key.name(), key.length(), &hash, value);
+}
+
+bool
+JSONParser::find(const JSONKey& key, int& value)
+{
+  VALIDATE_STATE();
+  const uint32_t hash = key.hash();
+  return findInt(*mState, mState->root(), key.name(), key.length(), &hash, value);
+}
+
+bool
+JSONParser::find(const std::string& key, const char*& value, size_t& length)
+{
+  VALIDATE_STATE();
+  return findView(*mState, mState->root(), key.c_str(), key.length(), NULL, value, length);
+}
+
+bool
+JSONParser::find(const JSONKey& key, const char*& value, size_t& length)
+{
+  VALIDATE_STATE();
+  const uint32_t hash = key.hash();
+  return findView(*mState, mState->root(), key.name(), key.length(), &hash, value, length);
+}
+
+int
+JSONParser::length()
+{
+  if (!mState) {
+    return 0;
   }
-  return result;
+  return mState->length(mState->root());
 }
 
 bool
-JSONParser::find(const std::string& key, int& value)
+JSONParser::find(int index, const std::string& key, std::string& value)
+{
+  VALIDATE_STATE();
+  return findString(*mState, mState->element(mState->root(), index), key.c_str(), key.length(), NULL, value);
+}
+
+bool
+JSONParser::find(int index, const std::string& key, int& value)
 {
   VALIDATE_STATE();
-  bool result = false;
+  return findInt(*mState, mState->element(mState->root(), index), key.c_str(), key.length(), NULL, value);
+}
 
-  if (mState->mTree) {
-    const char* path[2] = { key.c_str(), NULL };
-    yajl_val num = yajl_tree_get(mState->mTree, path, yajl_t_number);
-    if (YAJL_IS_INTEGER(num)) {
-      result = true;
-      value = (int)YAJL_GET_INTEGER(num);
+bool
+JSONParser::find(int index, const JSONKey& key, std::string& value)
+{
+  VALIDATE_STATE();
+  const uint32_t hash = key.hash();
+  return findString(*mState, mState->element(mState->root(), index), key.name(), key.length(), &hash, value);
+}
+
+bool
+JSONParser::find(int index, const JSONKey& key, int& value)
+{
+  VALIDATE_STATE();
+  const uint32_t hash = key.hash();
+  return findInt(*mState, mState->element(mState->root(), index), key.name(), key.length(), &hash, value);
+}
+
+bool
+JSONParser::find(int index, const std::string& key, const char*& value, size_t& length)
+{
+  VALIDATE_STATE();
+  return findView(*mState, mState->element(mState->root(), index), key.c_str(), key.length(), NULL, value, length);
+}
+
+bool
+JSONParser::find(int index, const JSONKey& key, const char*& value, size_t& length)
+{
+  VALIDATE_STATE();
+  const uint32_t hash = key.hash();
+  return findView(*mState, mState->element(mState->root(), index), key.name(), key.length(), &hash, value, length);
+}
+
+void
+SignalMessage::swap(SignalMessage& other)
+{
+  const unsigned int otherFields = other.fields;
+  const int otherIndex = other.sdpMLineIndex;
+  other.fields = fields;
+  other.sdpMLineIndex = sdpMLineIndex;
+  fields = otherFields;
+  sdpMLineIndex = otherIndex;
+  type.swap(other.type);
+  sdp.swap(other.sdp);
+  candidate.swap(other.candidate);
+  sdpMid.swap(other.sdpMid);
+}
+
+struct SignalDecoder::State {
+  std::vector<SignalMessage> mMessages;
+  int mCount;
+  std::string mError;
+  Arena mArena;
+
+  // Streaming. The handle lives across chunks, so it uses the regular heap
+  // rather than the arena.
+  yajl_handle mStream;
+  size_t mOffset;
+  size_t mErrorOffset;
+  int mValueStart;
+  std::vector<size_t> mValueEnds;
+  std::vector<int> mValueCounts;
+
+  // Parse position. Message objects sit at depth 1, or at depth 2 inside a
+  // top level array.
+  int mDepth;
+  int mMessageDepth;
+  SignalMessage* mCurrent;
+  unsigned int mField;
+
+  State() : mCount(0), mStream(NULL), mOffset(0), mErrorOffset(0), mValueStart(0), mDepth(0), mMessageDepth(1), mCurrent(NULL), mField(0) {}
+  ~State()
+  {
+    if (mStream) {
+      yajl_free(mStream); mStream = NULL;
+    }
+  }
+
+  void openStream()
+  {
+    if (mStream) {
+      yajl_free(mStream);
+    }
+    mStream = yajl_alloc(&sCallbacks, NULL, this);
+    if (mStream) {
+      yajl_config(mStream, yajl_allow_multiple_values, 1);
+    }
+  }
+
+  void restart()
+  {
+    mCount = 0;
+    mError.clear();
+    mDepth = 0;
+    mMessageDepth = 1;
+    mCurrent = NULL;
+    mField = 0;
+  }
+
+  // Called as the top level value closes.
+  void endValue()
+  {
+    if (mStream) {
+      mValueEnds.push_back(mOffset + yajl_get_bytes_consumed(mStream));
+      mValueCounts.push_back(mCount - mValueStart);
+      mValueStart = mCount;
+      mMessageDepth = 1;
     }
   }
-  return result;
+
+  // A scalar at the top level is a value of its own, with no messages.
+  void endScalar()
+  {
+    mField = 0;
+    if (mDepth == 0) {
+      endValue();
+    }
+  }
+
+  SignalMessage* begin()
+  {
+    if ((size_t)mCount == mMessages.size()) {
+      mMessages.push_back(SignalMessage());
+    }
+    SignalMessage* message = &mMessages[mCount++];
+    message->clear();
+    return message;
+  }
+
+  // A single message is finished once an offer or a candidate has all of
+  // its fields. Batches are always read to the end.
+  bool complete() const
+  {
+    if (!mCurrent || (mMessageDepth != 1) || mStream) {
+      return false;
+    }
+    return DescriptionSchema::complete(mCurrent->fields) || CandidateSchema::complete(mCurrent->fields);
+  }
+
+  static int Null(void* ctx) { ((State*)ctx)->endScalar(); return 1; }
+  static int Boolean(void* ctx, int) { ((State*)ctx)->endScalar(); return 1; }
+  static int Double(void* ctx, double) { ((State*)ctx)->endScalar(); return 1; }
+  static int Integer(void* ctx, long long value);
+  static int String(void* ctx, const unsigned char* value, size_t length);
+  static int StartMap(void* ctx);
+  static int MapKey(void* ctx, const unsigned char* key, size_t length);
+  static int EndMap(void* ctx);
+  static int StartArray(void* ctx);
+  static int EndArray(void* ctx);
+
+  static const yajl_callbacks sCallbacks;
+};
+
+const yajl_callbacks SignalDecoder::State::sCallbacks = {
+  Null,
+  Boolean,
+  Integer,
+  Double,
+  NULL,
+  String,
+  StartMap,
+  MapKey,
+  EndMap,
+  StartArray,
+  EndArray
+};
+
+int
+SignalDecoder::State::MapKey(void* ctx, const unsigned char* key, size_t length)
+{
+  State* state = (State*)ctx;
+  state->mField = 0;
+  if (state->mCurrent && (state->mDepth == state->mMessageDepth)) {
+    state->mField = SignalSchema::match((const char*)key, length);
+  }
+  return 1;
+}
+
+int
+SignalDecoder::State::String(void* ctx, const unsigned char* value, size_t length)
+{
+  State* state = (State*)ctx;
+  const unsigned int field = state->mField;
+  state->mField = 0;
+  if (field && SignalSchema::setString(*state->mCurrent, field, (const char*)value, length)) {
+    state->mCurrent->fields |= field;
+  }
+  state->endScalar();
+  // Returning zero cancels the parse, which is how yajl stops early.
+  return !state->complete();
+}
+
+int
+SignalDecoder::State::Integer(void* ctx, long long value)
+{
+  State* state = (State*)ctx;
+  const unsigned int field = state->mField;
+  state->mField = 0;
+  if (field && SignalSchema::setInteger(*state->mCurrent, field, value)) {
+    state->mCurrent->fields |= field;
+  }
+  state->endScalar();
+  return !state->complete();
+}
+
+int
+SignalDecoder::State::StartMap(void* ctx)
+{
+  State* state = (State*)ctx;
+  state->mField = 0;
+  state->mDepth++;
+  if (state->mDepth == state->mMessageDepth) {
+    state->mCurrent = state->begin();
+  }
+  return 1;
+}
+
+int
+SignalDecoder::State::EndMap(void* ctx)
+{
+  State* state = (State*)ctx;
+  if (state->mDepth == state->mMessageDepth) {
+    state->mCurrent = NULL;
+  }
+  state->mDepth--;
+  if (state->mDepth == 0) {
+    state->endValue();
+  }
+  return 1;
+}
+
+int
+SignalDecoder::State::StartArray(void* ctx)
+{
+  State* state = (State*)ctx;
+  state->mField = 0;
+  state->mDepth++;
+  if (state->mDepth == 1) {
+    state->mMessageDepth = 2;
+  }
+  return 1;
+}
+
+int
+SignalDecoder::State::EndArray(void* ctx)
+{
+  State* state = (State*)ctx;
+  state->mDepth--;
+  if (state->mDepth == 0) {
+    state->endValue();
+  }
+  return 1;
+}
+
+SignalDecoder::SignalDecoder() : mState(NULL)
+{
+  mState = new State;
+}
+
+SignalDecoder::~SignalDecoder()
+{
+  delete mState; mState = NULL;
+}
+
+int
+SignalDecoder::decode(const char* data, size_t length)
+{
+  if (!mState) {
+    return -1;
+  }
+  if (mState->mStream) {
+    // Sharing the message storage with a stream would corrupt it.
+    mState->mError = "decoder is streaming";
+    return -1;
+  }
+  mState->restart();
+  mState->mArena.reset();
+
+  yajl_handle handle = yajl_alloc(&State::sCallbacks, mState->mArena.funcs(), mState);
+  if (!handle) {
+    mState->mError = "out of memory";
+    return -1;
+  }
+  yajl_status status = yajl_parse(handle, (const unsigned char*)data, length);
+  if (status == yajl_status_ok) {
+    status = yajl_complete_parse(handle);
+  }
+  if (status == yajl_status_error) {
+    unsigned char* error = yajl_get_error(handle, 0, (const unsigned char*)data, length);
+    mState->mError = (const char*)error;
+    yajl_free_error(handle, error);
+    mState->mCount = -1;
+  }
+  yajl_free(handle);
+  return mState->mCount;
+}
+
+void
+SignalDecoder::beginStream()
+{
+  if (!mState) {
+    return;
+  }
+  mState->restart();
+  mState->mOffset = 0;
+  mState->mValueStart = 0;
+  mState->mValueEnds.clear();
+  mState->mValueCounts.clear();
+  mState->openStream();
+}
+
+void
+SignalDecoder::resumeStream(size_t from, size_t resume)
+{
+  if (!mState) {
+    return;
+  }
+  while (!mState->mValueEnds.empty() && (mState->mValueEnds.back() > from)) {
+    mState->mValueStart -= mState->mValueCounts.back();
+    mState->mValueEnds.pop_back();
+    mState->mValueCounts.pop_back();
+  }
+  mState->mCount = mState->mValueStart;
+  mState->mDepth = 0;
+  mState->mMessageDepth = 1;
+  mState->mCurrent = NULL;
+  mState->mField = 0;
+  mState->mOffset = resume;
+  mState->openStream();
+}
+
+bool
+SignalDecoder::feed(const char* data, size_t length)
+{
+  if (!mState || !mState->mStream) {
+    return false;
+  }
+  const yajl_status status = yajl_parse(mState->mStream, (const unsigned char*)data, length);
+  if (status != yajl_status_ok) {
+    unsigned char* error = yajl_get_error(mState->mStream, 0, (const unsigned char*)data, length);
+    mState->mError = (const char*)error;
+    yajl_free_error(mState->mStream, error);
+    mState->mErrorOffset = mState->mOffset + yajl_get_bytes_consumed(mState->mStream);
+    return false;
+  }
+  mState->mOffset += length;
+  return true;
+}
+
+size_t
+SignalDecoder::errorOffset() const
+{
+  return mState ? mState->mErrorOffset : 0;
+}
+
+int
+SignalDecoder::values() const
+{
+  return mState ? (int)mState->mValueEnds.size() : 0;
+}
+
+size_t
+SignalDecoder::valueEnd(int index) const
+{
+  return mState->mValueEnds[index];
+}
+
+int
+SignalDecoder::valueMessages(int index) const
+{
+  return mState->mValueCounts[index];
+}
+
+int
+SignalDecoder::take(int count, std::vector<SignalMessage>& messages)
+{
+  if (!mState) {
+    return 0;
+  }
+  int complete = 0;
+  for (int ix = 0; ix < count; ix++) {
+    complete += mState->mValueCounts[ix];
+  }
+  const int remaining = mState->mCount - complete;
+  const int current = (mState->mCurrent ? (int)(mState->mCurrent - &mState->mMessages[0]) - complete : -1);
+
+  messages.swap(mState->mMessages);
+  // Messages of later values, and of a value still under way, stay behind.
+  if ((int)mState->mMessages.size() < remaining) {
+    mState->mMessages.resize(remaining);
+  }
+  for (int ix = 0; ix < remaining; ix++) {
+    mState->mMessages[ix].swap(messages[complete + ix]);
+  }
+  mState->mCurrent = ((current >= 0) ? &mState->mMessages[current] : NULL);
+  mState->mCount = remaining;
+  mState->mValueStart -= complete;
+  mState->mValueEnds.erase(mState->mValueEnds.begin(), mState->mValueEnds.begin() + count);
+  mState->mValueCounts.erase(mState->mValueCounts.begin(), mState->mValueCounts.begin() + count);
+  return complete;
+}
+
+const SignalMessage&
+SignalDecoder::message(int index) const
+{
+  return mState->mMessages[index];
+}
+
+const std::string&
+SignalDecoder::error() const
+{
+  return mState->mError;
+}
+
+// Appends generated JSON to the output buffer.
+static void
+PrintToBuffer(void* ctx, const char* str, size_t len)
+{
+  FrameBuffer* output = (FrameBuffer*)ctx;
+  size_t available = 0;
+  char* buffer = output->reserve(len, available);
+  if (buffer) {
+    memcpy(buffer, str, len);
+    output->commit(len);
+  }
 }
 
 struct JSONGenerator::State {
   yajl_gen mGen;
   State() : mGen(yajl_gen_alloc(NULL)) {}
+  State(FrameBuffer& output) : mGen(yajl_gen_alloc(NULL))
+  {
+    yajl_gen_config(mGen, yajl_gen_print_callback, PrintToBuffer, &output);
+  }
   ~State()
   {
     yajl_gen_free(mGen);
@@ -92,11 +958,25 @@ JSONGenerator::JSONGenerator() : mState (NULL)
   mState = new State;
 }
 
+JSONGenerator::JSONGenerator(FrameBuffer& output) : mState (NULL)
+{
+  mState = new State(output);
+}
+
 JSONGenerator::~JSONGenerator()
 {
   delete mState; mState = NULL;
 }
 
+void
+JSONGenerator::clear()
+{
+  if (mState) {
+    yajl_gen_clear(mState->mGen);
+    yajl_gen_reset(mState->mGen, NULL);
+  }
+}
+
 bool
 JSONGenerator::openMap()
 {
@@ -118,32 +998,69 @@ JSONGenerator::closeMap()
 }
 
 bool
-JSONGenerator::addPair(const std::string& key, const std::string& value)
+JSONGenerator::openArray()
 {
   VALIDATE_STATE();
-  if (yajl_gen_string(mState->mGen, (const unsigned char *)key.c_str(), key.length()) != yajl_gen_status_ok) {
-    return false;
-  } else if (yajl_gen_string(mState->mGen, (const unsigned char *)value.c_str(), value.length()) != yajl_gen_status_ok) {
+  if (yajl_gen_array_open(mState->mGen) != yajl_gen_status_ok) {
     return false;
   }
   return true;
 }
 
 bool
-JSONGenerator::addPair(const std::string& key, const int value)
+JSONGenerator::closeArray()
 {
   VALIDATE_STATE();
-  std::stringstream stream;
-  stream << value;
-  std::string str = stream.str();
-  if (yajl_gen_string(mState->mGen, (const unsigned char *)key.c_str(), key.length()) != yajl_gen_status_ok) {
-    return false;
-  } else if (yajl_gen_number(mState->mGen, str.c_str(), str.length()) != yajl_gen_status_ok) {
+  if (yajl_gen_array_close(mState->mGen) != yajl_gen_status_ok) {
     return false;
   }
   return true;
 }
 
+bool
+JSONGenerator::addString(const char* data, size_t length)
+{
+  VALIDATE_STATE();
+  return yajl_gen_string(mState->mGen, (const unsigned char *)data, length) == yajl_gen_status_ok;
+}
+
+bool
+JSONGenerator::addInteger(int value)
+{
+  VALIDATE_STATE();
+  return yajl_gen_integer(mState->mGen, value) == yajl_gen_status_ok;
+}
+
+bool
+JSONGenerator::addPair(const std::string& key, const std::string& value)
+{
+  return addString(key.data(), key.length()) && addString(value.data(), value.length());
+}
+
+bool
+JSONGenerator::addPair(const char* key, const std::string& value)
+{
+  return addString(key, strlen(key)) && addString(value.data(), value.length());
+}
+
+bool
+JSONGenerator::addPair(const char* key, const char* value)
+{
+  return addString(key, strlen(key)) && addString(value, strlen(value));
+}
+
+bool
+JSONGenerator::addPair(const std::string& key, const int value)
+{
+  return addString(key.data(), key.length()) && addInteger(value);
+}
+
+bool
+JSONGenerator::addPair(const char* key, const int value)
+{
+  return addString(key, strlen(key)) && addInteger(value);
+}
+
 bool
 JSONGenerator::getJSON(std::string& key)
 {
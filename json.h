@@ -1,44 +1,194 @@
 #ifndef JSON_DOT_H
 #define JSON_DOT_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include <string>
+#include <vector>
 
+#include "schema.h"
+
+// An object key with its hash computed once, for keys looked up in every
+// message.
+class JSONKey {
+public:
+  explicit JSONKey(const char* name);
+  explicit JSONKey(const std::string& name);
+
+  const char* name() const { return mName.c_str(); }
+  size_t length() const { return mName.length(); }
+  uint32_t hash() const { return mHash; }
+
+  static uint32_t Hash(const char* data, size_t length);
+
+protected:
+  std::string mName;
+  uint32_t mHash;
+};
+
+// Large objects are indexed by key hash the first time they are searched,
+// so further finds on them do not scan every key. Documents are parsed by
+// yajl_tree, or by the SIMD parser in tape.h when built with
+// JSON_TAPE_PARSER, which does not accept comments.
 class JSONParser {
 public:
+  JSONParser();
   JSONParser(const char* data);
   ~JSONParser();
 
+  // Parses another document, replacing the current one. A parser that is
+  // reused keeps its memory, so steady state parsing does not allocate.
+  bool parse(const char* data);
+  // Parses length bytes of data destructively. Strings are unescaped inside
+  // data and the tree points at them there instead of holding copies, so
+  // data must stay alive and untouched until the next parse.
+  bool parseInPlace(char* data, size_t length);
+
   bool isValid(std::string& error);
   bool find(const std::string& key, std::string& value);
   bool find(const std::string& key, int& value);
+  bool find(const JSONKey& key, std::string& value);
+  bool find(const JSONKey& key, int& value);
+  // A view of a string value, NUL terminated, that is valid until the next
+  // parse. After parseInPlace it points into the caller's data.
+  bool find(const std::string& key, const char*& value, size_t& length);
+  bool find(const JSONKey& key, const char*& value, size_t& length);
+
+  // Number of elements when the document is an array, otherwise 0. The
+  // indexed finds look up a key in the object at that element.
+  int length();
+  bool find(int index, const std::string& key, std::string& value);
+  bool find(int index, const std::string& key, int& value);
+  bool find(int index, const JSONKey& key, std::string& value);
+  bool find(int index, const JSONKey& key, int& value);
+  bool find(int index, const std::string& key, const char*& value, size_t& length);
+  bool find(int index, const JSONKey& key, const char*& value, size_t& length);
 
 protected:
   struct State;
   State* mState;
 };
 
+// The fields of a signaling message, an offer or an ICE candidate.
+struct SignalMessage {
+  enum Field {
+    FieldType = 0x01,
+    FieldSdp = 0x02,
+    FieldCandidate = 0x04,
+    FieldSdpMid = 0x08,
+    FieldSdpMLineIndex = 0x10
+  };
+
+  // Bit mask of the fields present.
+  unsigned int fields;
+  std::string type;
+  std::string sdp;
+  std::string candidate;
+  std::string sdpMid;
+  int sdpMLineIndex;
+
+  SignalMessage() : fields(0), sdpMLineIndex(0) {}
+  bool has(Field field) const { return (fields & field) != 0; }
+  // Keeps the string buffers for the next message.
+  void clear() { fields = 0; sdpMLineIndex = 0; }
+  void swap(SignalMessage& other);
+};
+
+namespace signal_keys {
+SCHEMA_KEY(Type, "type");
+SCHEMA_KEY(Sdp, "sdp");
+SCHEMA_KEY(Candidate, "candidate");
+SCHEMA_KEY(SdpMid, "sdpMid");
+SCHEMA_KEY(SdpMLineIndex, "sdpMLineIndex");
+} // namespace signal_keys
+
+typedef schema::String<signal_keys::Type, SignalMessage, SignalMessage::FieldType, &SignalMessage::type> SignalTypeField;
+typedef schema::String<signal_keys::Sdp, SignalMessage, SignalMessage::FieldSdp, &SignalMessage::sdp> SignalSdpField;
+typedef schema::String<signal_keys::Candidate, SignalMessage, SignalMessage::FieldCandidate, &SignalMessage::candidate> SignalCandidateField;
+typedef schema::String<signal_keys::SdpMid, SignalMessage, SignalMessage::FieldSdpMid, &SignalMessage::sdpMid> SignalSdpMidField;
+typedef schema::Integer<signal_keys::SdpMLineIndex, SignalMessage, SignalMessage::FieldSdpMLineIndex, &SignalMessage::sdpMLineIndex> SignalSdpMLineIndexField;
+
+// An offer or answer, and a trickled ICE candidate. SignalSchema is every
+// key a signaling message may carry.
+typedef schema::Schema<SignalMessage, SignalTypeField, SignalSdpField> DescriptionSchema;
+typedef schema::Schema<SignalMessage, SignalCandidateField, SignalSdpMidField, SignalSdpMLineIndexField> CandidateSchema;
+typedef schema::Schema<SignalMessage, SignalTypeField, SignalSdpField, SignalCandidateField, SignalSdpMidField, SignalSdpMLineIndexField> SignalSchema;
+
+// Streams a signaling message through the yajl callbacks straight into
+// SignalMessage fields, without building a tree. Keys and values go through
+// SignalSchema. Stops as soon as an offer or candidate has everything it
+// needs. Reusing one decoder keeps message storage and parser memory between
+// calls.
+class SignalDecoder {
+public:
+  SignalDecoder();
+  ~SignalDecoder();
+
+  // Decodes one message object, or an array of them as sent for a batch of
+  // candidates. Returns the number of messages, or -1 on a parse error.
+  int decode(const char* data, size_t length);
+  const SignalMessage& message(int index) const;
+  const std::string& error() const;
+
+  // Incremental decoding. Chunks are fed as they arrive off the socket and
+  // each top level value is reported as soon as it closes. Single messages
+  // are read to the end, since the stream continues past them.
+  void beginStream();
+  // Returns false on a parse error. Nothing more is parsed until the stream
+  // is resumed past the error.
+  bool feed(const char* data, size_t length);
+  // Stream offset of the last parse error.
+  size_t errorOffset() const;
+  // Drops the values that end after stream offset from, and whatever was
+  // parsed of the value under way, then starts parsing afresh with the
+  // chunk at stream offset resume.
+  void resumeStream(size_t from, size_t resume);
+  // Values completed since the last take(). The end is the stream offset
+  // just past the value, counting from beginStream().
+  int values() const;
+  size_t valueEnd(int index) const;
+  int valueMessages(int index) const;
+  // Swaps the messages of the first count completed values into messages,
+  // whose old entries are kept for reuse. Returns how many messages it
+  // holds.
+  int take(int count, std::vector<SignalMessage>& messages);
+
+protected:
+  struct State;
+  State* mState;
+};
+
+class FrameBuffer;
+
+// A generator made with an output appends to it through yajl's print
+// callback instead of collecting the JSON for getJSON(). It is meant to
+// live as long as the connection, with clear() before each message, so
+// building one does not allocate once the output has grown.
 class JSONGenerator {
 public:
   JSONGenerator();
+  explicit JSONGenerator(FrameBuffer& output);
   ~JSONGenerator();
 
+  // Starts over for the next message. The output is left to its owner.
+  void clear();
+
   bool openMap();
   bool closeMap();
+  bool openArray();
+  bool closeArray();
   bool addPair(const std::string& key, const std::string& value);
-  bool addPair(const char* key, const std::string& value)
-  {
-    const std::string strKey(key);
-    return addPair(strKey, value);
-  }
+  bool addPair(const char* key, const std::string& value);
+  bool addPair(const char* key, const char* value);
   bool addPair(const std::string& key, const int value);
-  bool addPair(const char* key, const int value)
-  {
-    const std::string strKey(key);
-    return addPair(strKey, value);
-  }
+  bool addPair(const char* key, const int value);
+  // Fails for a generator with an output.
   bool getJSON(std::string& key);
 
 protected:
+  bool addString(const char* data, size_t length);
+  bool addInteger(int value);
+
   struct State;
   State* mState;
 };
@@ -0,0 +1,57 @@
+#include "mailbox.h"
+
+FrameMailbox::FrameMailbox() :
+  mMiddle(1),
+  mPublishing(0),
+  mBack(0),
+  mSequence(0),
+  mPublished(0),
+  mProducerSuperseded(0),
+  mProducerDropped(0),
+  mFront(2),
+  mLastSequence(0),
+  mTaken(0),
+  mConsumerSuperseded(0),
+  mConsumerDropped(0) {}
+
+VideoFrameSlot*
+FrameMailbox::beginPublish()
+{
+  // Sessions each have a sink, so more than one media thread may publish.
+  // The loser drops its frame rather than wait.
+  if (mPublishing.exchange(1) != 0) {
+    mProducerDropped++;
+    return NULL;
+  }
+  return &mSlots[mBack];
+}
+
+bool
+FrameMailbox::endPublish()
+{
+  mSlots[mBack].mSequence = ++mSequence;
+  const uint32_t previous = mMiddle.exchange(mBack | sFresh);
+  mBack = previous & sIndexMask;
+  mPublished++;
+  mPublishing = 0;
+  if (previous & sFresh) {
+    mProducerSuperseded++;
+    return false;
+  }
+  return true;
+}
+
+VideoFrameSlot*
+FrameMailbox::take()
+{
+  if ((mMiddle & sFresh) == 0) {
+    return NULL;
+  }
+  // Only the producer sets sFresh, so the middle slot is still unread here.
+  mFront = mMiddle.exchange(mFront) & sIndexMask;
+  VideoFrameSlot* slot = &mSlots[mFront];
+  mTaken++;
+  mConsumerSuperseded += slot->mSequence - mLastSequence - 1;
+  mLastSequence = slot->mSequence;
+  return slot;
+}
@@ -0,0 +1,76 @@
+#ifndef MAILBOX_DOT_H
+#define MAILBOX_DOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "mozilla/Atomics.h"
+
+// One decoded I420 picture waiting to be drawn.
+struct VideoFrameSlot {
+  std::vector<unsigned char> mImage;
+  int mWidth;
+  int mHeight;
+  // Counts up from 1 with every publish, so the renderer can tell how many
+  // frames were replaced before it got to them.
+  uint32_t mSequence;
+  VideoFrameSlot() : mWidth(0), mHeight(0), mSequence(0) {}
+};
+
+// Lock-free, latest frame wins, triple buffer from the media thread to the
+// render thread. The producer fills its back slot and swaps it with the
+// middle one, the consumer swaps the middle one with its front slot. Neither
+// side waits for the other, and a frame that is published before the last
+// one was taken simply replaces it.
+class FrameMailbox {
+public:
+  FrameMailbox();
+
+  // Producer. Returns the slot to fill, or NULL when another thread is
+  // already publishing, in which case the frame is counted as dropped.
+  VideoFrameSlot* beginPublish();
+  // Returns true when the middle slot was empty and the consumer needs a
+  // wakeup, false when the frame superseded one that was never taken.
+  bool endPublish();
+
+  // Consumer. Returns the newest frame, or NULL when nothing was published
+  // since the last call. The slot is the consumer's until the next take().
+  VideoFrameSlot* take();
+
+  // Producer side.
+  uint32_t published() const { return mPublished; }
+  uint32_t producerSuperseded() const { return mProducerSuperseded; }
+  uint32_t producerDropped() const { return mProducerDropped; }
+  // Consumer side. Superseded frames are the gaps in the sequence numbers
+  // the consumer saw, dropped ones are those it took but could not draw.
+  uint32_t taken() const { return mTaken; }
+  uint32_t consumerSuperseded() const { return mConsumerSuperseded; }
+  uint32_t consumerDropped() const { return mConsumerDropped; }
+  void consumerDrop() { mConsumerDropped++; }
+
+protected:
+  // Low bits of mMiddle are the slot index, this bit marks it unread.
+  static const uint32_t sFresh = 0x4;
+  static const uint32_t sIndexMask = 0x3;
+
+  VideoFrameSlot mSlots[3];
+  mozilla::Atomic<uint32_t> mMiddle;
+  mozilla::Atomic<uint32_t> mPublishing;
+
+  // Only touched by the producer, read anywhere for stats.
+  uint32_t mBack;
+  uint32_t mSequence;
+  mozilla::Atomic<uint32_t> mPublished;
+  mozilla::Atomic<uint32_t> mProducerSuperseded;
+  mozilla::Atomic<uint32_t> mProducerDropped;
+
+  // Only touched by the consumer.
+  uint32_t mFront;
+  uint32_t mLastSequence;
+  mozilla::Atomic<uint32_t> mTaken;
+  mozilla::Atomic<uint32_t> mConsumerSuperseded;
+  mozilla::Atomic<uint32_t> mConsumerDropped;
+};
+
+#endif // #define MAILBOX_DOT_H
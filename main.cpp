@@ -32,14 +32,38 @@
 #include "prerror.h"
 #include "prio.h"
 
+#include "cbor.h"
+#include "framer.h"
 #include "json.h"
+#include "msgqueue.h"
 #include "render.h"
+#include "transport.h"
+#include "websocket.h"
+#include "writer.h"
 
 #define LOG(format, ...) fprintf(stderr, format, ##__VA_ARGS__);
 
 const char JSONTerminator[] = "\r\n";
 const int JSONTerminatorSize = sizeof(JSONTerminator) - 1;
 
+// Local candidates gathered within this many milliseconds are sent as one
+// JSON array message. Zero sends each candidate as soon as it is gathered.
+static int sCandidateBatchMs = 0;
+
+// A client that wants length prefixed framing opens the connection with one
+// of these instead of a JSON message. The suffix picks the payload encoding.
+const char PrefixedJSONPreamble[] = "SIGJ";
+const char PrefixedCBORPreamble[] = "SIGC";
+const size_t PreambleSize = sizeof(PrefixedJSONPreamble) - 1;
+
+static const int sSignalingPort = 8011;
+
+// Connections beyond this many concurrent sessions are closed on accept.
+static int sMaxSessions = 1;
+
+// Non-zero drives the signaling sockets from an epoll thread on Linux.
+static int sEpoll = 0;
+
 namespace {
 
 void
@@ -58,15 +82,63 @@ LogPRError()
   }
 }
 
+bool
+IsBlank(const char* aData, size_t aLength)
+{
+  for (size_t ix = 0; ix < aLength; ix++) {
+    const char c = aData[ix];
+    if ((c != ' ') && (c != '\t') && (c != '\r') && (c != '\n')) {
+      return false;
+    }
+  }
+  return true;
+}
+
 class PCObserver;
+class SocketHandler;
 typedef media::MutexAutoLock MutexAutoLock;
 
+struct Candidate {
+  std::string mCandidate;
+  std::string mMid;
+  int mIndex;
+};
+
+enum Encoding {
+  EncodingJSON,
+  EncodingCBOR
+};
+
 struct State {
   mozilla::RefPtr<nsIDOMMediaStream> mStream;
   mozilla::RefPtr<sipcc::PeerConnectionImpl> mPeerConnection;
   mozilla::RefPtr<PCObserver> mPeerConnectionObserver;
+  mozilla::RefPtr<SocketHandler> mHandler;
+  mozilla::RefPtr<SignalWriter> mWriter;
+  mozilla::RefPtr<MessageQueue> mQueue;
+  mozilla::RefPtr<media::Timer> mCandidateTimer;
+  mozilla::RefPtr<media::Timer> mPullTimer;
+  std::vector<Candidate> mCandidates;
+  // Build outgoing JSON and CBOR on the main thread straight into mWriter.
+  JSONGenerator mGenerator;
+  CBORGenerator mCBORGenerator;
   PRFileDesc* mSocket;
-  State() : mSocket(nullptr) {}
+  // Set by the socket thread before the first message is published.
+  Encoding mEncoding;
+  // Counted by the VideoSink on the media thread.
+  mozilla::Atomic<uint32_t> mFramesQueued;
+  mozilla::Atomic<uint32_t> mFramesSuperseded;
+  mozilla::Atomic<uint32_t> mFramesDropped;
+  State() :
+    mWriter(new SignalWriter(JSONTerminator, JSONTerminatorSize)),
+    mQueue(new MessageQueue),
+    mGenerator(mWriter->message()),
+    mCBORGenerator(mWriter->message()),
+    mSocket(nullptr),
+    mEncoding(EncodingJSON),
+    mFramesQueued(0),
+    mFramesSuperseded(0),
+    mFramesDropped(0) {}
   MEDIA_REF_COUNT_INLINE
 };
 
@@ -83,12 +155,24 @@ public:
     media::VideoSegment* segment = reinterpret_cast<media::VideoSegment*>(aSegment);
     if (segment && mState) {
       const media::VideoFrame *frame = segment->GetLastFrame();
-      unsigned int size;
-      const unsigned char *image = frame->GetImage(&size);
-      if (size > 0) {
-        int width = 0, height = 0;
+      unsigned int size = 0;
+      const unsigned char *image = frame ? frame->GetImage(&size) : nullptr;
+      int width = 0, height = 0;
+      if (frame) {
         frame->GetWidthAndHeight(&width, &height);
-        render::Draw(image, size, width, height);
+      }
+      // Drawing happens on the render thread, this only hands the frame over.
+      switch (render::Publish(image, size, width, height)) {
+      case render::PublishQueued:
+        mState->mFramesQueued++;
+        break;
+      case render::PublishSuperseded:
+        mState->mFramesQueued++;
+        mState->mFramesSuperseded++;
+        break;
+      case render::PublishDropped:
+        mState->mFramesDropped++;
+        break;
       }
     }
   }
@@ -96,21 +180,72 @@ protected:
   mozilla::RefPtr<State> mState;
 };
 
-static const int sBufferLength = 2048;
+// Long lived runnable that drains the session's MessageQueue on the main
+// thread. It is only dispatched when the queue goes from idle to busy.
+class ProcessMessage : public media::Runnable {
+public:
+  ProcessMessage(mozilla::RefPtr<State>& aState) :
+    mState(aState) {}
+  virtual nsresult Run();
+protected:
+  void HandleMessage(const char* aMessage, size_t aLength);
+  void HandleSignal(const SignalMessage& aSignal, const char* aMessage);
+
+  mozilla::RefPtr<State> mState;
+  // Kept across messages so decoding reuses their storage.
+  SignalDecoder mDecoder;
+  SignalMessage mSignal;
+};
 
-class SocketHandler : public media::ASocketHandler {
+class SocketHandler : public SignalHandler {
 MEDIA_REF_COUNT_INLINE
 public:
-  SocketHandler(mozilla::RefPtr<State>& aState) : mState(aState) {
+  SocketHandler(mozilla::RefPtr<State>& aState) :
+    mState(aState),
+    mProcess(new ProcessMessage(aState)),
+    mFramer(JSONTerminator, JSONTerminatorSize),
+    mStreaming(false),
+    mParseFailed(false),
+    mStreamed(0),
+    mNegotiated(false),
+    mClosed(false) {
     mPollFlags = PR_POLL_READ;
   }
   virtual void OnSocketReady(PRFileDesc *fd, int16_t outFlags);
   virtual void OnSocketDetached(PRFileDesc *fd);
+  void Publish();
 
 protected:
-  char mBuffer[sBufferLength];
-  std::string mMessage;
+  bool Negotiate();
+  bool Upgrade();
+  void Control(const FrameSlice& aSlice);
+  void Write(const char* aData, size_t aLength, int aOpcode);
+  void Feed(const char* aData, size_t aLength);
+  bool MatchValues(const FrameSlice& aSlice, int& aValues, int& aSignals);
+
   mozilla::RefPtr<State> mState;
+  mozilla::RefPtr<ProcessMessage> mProcess;
+  Framer mFramer;
+  // CRLF delimited JSON is parsed on this thread as each read arrives,
+  // while the framer still splits messages at the CRLF. mStreamed is the
+  // stream offset of the framer's pending data.
+  SignalDecoder mDecoder;
+  bool mStreaming;
+  bool mParseFailed;
+  size_t mStreamed;
+  bool mNegotiated;
+  bool mClosed;
+};
+
+// Accepts signaling connections for as long as the process runs.
+class ListenHandler : public SignalHandler {
+MEDIA_REF_COUNT_INLINE
+public:
+  ListenHandler() {
+    mPollFlags = PR_POLL_READ;
+  }
+  virtual void OnSocketReady(PRFileDesc *fd, int16_t outFlags);
+  virtual void OnSocketDetached(PRFileDesc *fd);
 };
 
 
@@ -157,87 +292,162 @@ class PullTimer : public media::TimerCallback
 {
 MEDIA_REF_COUNT_INLINE
 public:
-  PullTimer(const mozilla::RefPtr<State>& aState) : mState(aState) {}
+  PullTimer(const mozilla::RefPtr<State>& aState) : mState(aState), mPulled(0) {}
   // media::TimerCallback
   NS_IMETHOD Notify(media::Timer *timer);
 protected:
   mozilla::RefPtr<State> mState;
+  uint64_t mPulled;
 };
 
-class ProcessMessage : public media::Runnable {
+class CandidateTimer : public media::TimerCallback
+{
+MEDIA_REF_COUNT_INLINE
+public:
+  CandidateTimer(const mozilla::RefPtr<State>& aState) : mState(aState) {}
+  // media::TimerCallback
+  NS_IMETHOD Notify(media::Timer *timer);
+protected:
+  mozilla::RefPtr<State> mState;
+};
+
+class StartSession : public media::Runnable {
+public:
+  StartSession(PRFileDesc* aSocket) : mSocket(aSocket) {}
+  virtual nsresult Run();
+protected:
+  PRFileDesc* mSocket;
+};
+
+class EndSession : public media::Runnable {
+public:
+  EndSession(const mozilla::RefPtr<State>& aState) : mState(aState) {}
+  virtual nsresult Run();
+protected:
+  mozilla::RefPtr<State> mState;
+};
+
+class StopListening : public media::Runnable {
 public:
-  ProcessMessage(mozilla::RefPtr<State>& aState) :
-    mState(aState) {}
   virtual nsresult Run();
-  void addMessage(const std::string& aMessage)
+};
+
+// Only touched on the main thread.
+static std::vector<mozilla::RefPtr<State> > sSessions;
+static bool sListening = true;
+
+class WatchForWrite : public media::Runnable {
+public:
+  WatchForWrite(const mozilla::RefPtr<SocketHandler>& aHandler) : mHandler(aHandler) {}
+  virtual nsresult Run(void)
   {
-    mMessageList.push_back(aMessage);
+    mHandler->watchForWrite();
+    return NS_OK;
   }
 protected:
-  mozilla::RefPtr<State> mState;
-  std::vector<std::string> mMessageList;
+  mozilla::RefPtr<SocketHandler> mHandler;
 };
 
-class DispatchSocketHandler : public media::Runnable {
+class CloseConnection : public media::Runnable {
 public:
-  DispatchSocketHandler(PRFileDesc* aSocket, mozilla::RefPtr<SocketHandler>& aHandler) :
-    mSocket(aSocket),
-    mHandler(aHandler) {}
+  CloseConnection(const mozilla::RefPtr<SocketHandler>& aHandler) : mHandler(aHandler) {}
   virtual nsresult Run(void)
   {
-    mozilla::RefPtr<media::SocketTransportService> sts = media::GetSocketTransportService();
-    sts->AttachSocket(mSocket, mHandler);
+    mHandler->close(NS_BASE_STREAM_CLOSED);
+    return NS_OK;
+  }
+protected:
+  mozilla::RefPtr<SocketHandler> mHandler;
+};
+
+class ResumePublish : public media::Runnable {
+public:
+  ResumePublish(const mozilla::RefPtr<SocketHandler>& aHandler) : mHandler(aHandler) {}
+  virtual nsresult Run(void)
+  {
+    mHandler->Publish();
     return NS_OK;
   }
 protected:
-  PRFileDesc* mSocket;
   mozilla::RefPtr<SocketHandler> mHandler;
 };
 
+void
+HandleSendResult(State* aState, SignalWriter::Result aResult)
+{
+  switch (aResult) {
+  case SignalWriter::StartPolling:
+    if (aState->mHandler) {
+      mozilla::RefPtr<WatchForWrite> watch = new WatchForWrite(aState->mHandler);
+      transport::Dispatch(watch);
+    }
+    break;
+  case SignalWriter::Failed:
+    // The peer may have been sent part of a message, so the connection
+    // cannot be used any more.
+    LogPRError();
+    if (aState->mHandler) {
+      mozilla::RefPtr<CloseConnection> close = new CloseConnection(aState->mHandler);
+      transport::Dispatch(close);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
 void
 SocketHandler::OnSocketReady(PRFileDesc *fd, int16_t outFlags)
 {
-  static const std::string Term(JSONTerminator);
   if (outFlags & PR_POLL_READ) {
-    memset(mBuffer, 0, sBufferLength);
-    PRInt32 read = PR_Recv(fd, mBuffer, sBufferLength, 0, PR_INTERVAL_NO_WAIT);
-    if (read > 0) {
-      LOG("Received ->\n%s\n", mBuffer);
-      mozilla::RefPtr<ProcessMessage> pmsg = new ProcessMessage(mState);
-      mMessage += mBuffer;
-
-      size_t start = 0;
-      size_t found = mMessage.find(Term);
-      if (found != std::string::npos) {
-        while (found != std::string::npos) {
-          pmsg->addMessage(mMessage.substr(start, found - start));
-          start = found + JSONTerminatorSize;
-          found = mMessage.find(Term, start);
-        }
-        // Save any partial messages until the rest is received.
-        if (start < mMessage.length()) {
-          std::string remainder = mMessage.substr(start);
-          mMessage = remainder;
-          LOG("Saved: '%s'\n", mMessage.c_str());
-        }
-        else {
-          mMessage.clear();
+    // Keep reading until the socket would block so a large offer does not
+    // need a trip through the poll loop for every buffer full.
+    mFramer.markCycle();
+    bool received = false;
+    bool closed = false;
+    while (true) {
+      size_t available = 0;
+      char* buffer = mFramer.reserve(available);
+      if (!buffer) {
+        Publish();
+        buffer = mFramer.reserve(available);
+      }
+      if (!buffer) {
+        LOG("ERROR: Signaling connection is holding too much unprocessed data.\n");
+        closed = true;
+        break;
+      }
+      PRInt32 read = PR_Recv(fd, buffer, (PRInt32)available, 0, PR_INTERVAL_NO_WAIT);
+      if (read > 0) {
+        LOG("Received ->\n%.*s\n", (int)read, buffer);
+        mFramer.commit(read);
+        received = true;
+        if (mStreaming) {
+          Feed(buffer, read);
         }
-
-        NS_DispatchToMainThread(pmsg);
+      }
+      else {
+        closed = (read == 0) || (PR_GetError() != PR_WOULD_BLOCK_ERROR);
+        break;
       }
     }
-    else {
-      mCondition = NS_BASE_STREAM_CLOSED;
-      static bool failed = false;
-      if (!failed) {
+
+    if (received) {
+      Publish();
+    }
+
+    if (closed) {
+      close(NS_BASE_STREAM_CLOSED);
+      if (!mClosed) {
         LOG("No data on socket ready. Assuming connection lost.\n");
-        failed = true;
+        mClosed = true;
       }
     }
   }
   if (outFlags & PR_POLL_WRITE) {
-     LOG("\n*** PR_POLL_WRITE\n");
+    if (!mState->mWriter->flush()) {
+      mPollFlags &= ~PR_POLL_WRITE;
+    }
   }
   if (outFlags & PR_POLL_EXCEPT) {
      LOG("\n*** PR_POLL_EXCEPT\n");
@@ -253,14 +463,296 @@ SocketHandler::OnSocketReady(PRFileDesc *fd, int16_t outFlags)
   }
 }
 
+// Moves every complete message into the next free queue slot. The receive
+// buffer is swapped with the slot's recycled one, so nothing is copied but a
+// trailing partial message.
+void
+SocketHandler::Publish()
+{
+  if (!mNegotiated && !Negotiate()) {
+    return;
+  }
+
+  MessageQueue* queue = mState->mQueue;
+  MessageBatch* batch = queue->beginPublish();
+  if (!batch) {
+    // The main thread dispatches a ResumePublish once it frees a slot.
+    return;
+  }
+
+  FrameSlice slice;
+  int values = 0;
+  int signals = 0;
+  while (mFramer.next(slice)) {
+    if (slice.opcode & 0x08) {
+      Control(slice);
+      continue;
+    }
+    if (mStreaming) {
+      if (!MatchValues(slice, values, signals)) {
+        continue;
+      }
+      batch->mSignalCounts.push_back(signals);
+    }
+    LOG("Message of %u bytes took %u poll cycles\n", (unsigned int)slice.length, slice.cycles);
+    batch->mMessages.push_back(slice);
+  }
+  if (values > 0) {
+    mDecoder.take(values, batch->mSignals);
+  }
+  if (mFramer.failed() && !mClosed) {
+    LOG("ERROR: Signaling connection broke the framing rules.\n");
+    close(NS_BASE_STREAM_CLOSED);
+    mClosed = true;
+  }
+
+  if (!batch->mMessages.empty()) {
+    mFramer.detach(batch->mBuffer);
+    if (mFramer.pending() > 0) {
+      LOG("Saved: '%.*s'\n", (int)mFramer.pending(), mFramer.pendingData());
+    }
+    if (queue->endPublish()) {
+      NS_DispatchToMainThread(mProcess);
+    }
+  }
+}
+
+// Picks the framing from the first bytes of the connection. Returns false
+// until enough has arrived to tell.
+bool
+SocketHandler::Negotiate()
+{
+  const size_t pending = mFramer.pending();
+  const char* data = mFramer.pendingData();
+  if ((pending == 0) || ((data[0] == PrefixedJSONPreamble[0]) && (pending < PreambleSize))) {
+    return false;
+  }
+  if ((data[0] == 'G') && (pending < 4)) {
+    return false;
+  }
+  if (websocket::IsUpgrade(data, pending)) {
+    return Upgrade();
+  }
+
+  mNegotiated = true;
+  const bool json = (memcmp(data, PrefixedJSONPreamble, PreambleSize) == 0);
+  const bool cbor = (memcmp(data, PrefixedCBORPreamble, PreambleSize) == 0);
+  if ((data[0] == PrefixedJSONPreamble[0]) && (json || cbor)) {
+    mFramer.discard(PreambleSize);
+    mFramer.setMode(Framer::FramePrefixed);
+    mState->mEncoding = (cbor ? EncodingCBOR : EncodingJSON);
+    mState->mWriter->setMode(Framer::FramePrefixed);
+    LOG("Using length prefixed %s signaling\n", (cbor ? "CBOR" : "JSON"));
+  }
+  else {
+    // Catch the parser up on everything read before the framing was known.
+    mStreaming = true;
+    mDecoder.beginStream();
+    Feed(mFramer.pendingData(), mFramer.pending());
+  }
+  return true;
+}
+
+// Parses another chunk of the stream. After a parse error nothing more is
+// fed until Publish reaches the message at fault and resumes past it.
+void
+SocketHandler::Feed(const char* aData, size_t aLength)
+{
+  if (!mParseFailed && !mDecoder.feed(aData, aLength)) {
+    mParseFailed = true;
+  }
+}
+
+// Pairs a CRLF delimited message with the values the parser found in it,
+// counting on from aValues. A message the parser failed on, or that ends
+// inside a value, is logged and dropped, and parsing starts over right
+// after it. Returns false for a message that is not to be published.
+bool
+SocketHandler::MatchValues(const FrameSlice& aSlice, int& aValues, int& aSignals)
+{
+  const char* message = mFramer.data() + aSlice.offset;
+  const size_t start = mStreamed;
+  mStreamed += aSlice.length + JSONTerminatorSize;
+
+  int values = aValues;
+  size_t parsed = 0;
+  aSignals = 0;
+  while ((values < mDecoder.values()) && (mDecoder.valueEnd(values) <= mStreamed)) {
+    aSignals += mDecoder.valueMessages(values);
+    parsed = mDecoder.valueEnd(values) - start;
+    values++;
+  }
+  if (parsed > aSlice.length) {
+    parsed = aSlice.length;
+  }
+  if (mParseFailed && (mDecoder.errorOffset() < mStreamed)) {
+    LOG("ERROR: Failed to parse signaling message: %s\n%s\n", mDecoder.error().c_str(), message);
+  }
+  else if (!IsBlank(message + parsed, aSlice.length - parsed)) {
+    LOG("ERROR: Signaling message ends inside a value:\n%s\n", message);
+  }
+  else {
+    const bool found = (values > aValues);
+    aValues = values;
+    return found;
+  }
+
+  mDecoder.resumeStream(start, mStreamed);
+  mParseFailed = false;
+  Feed(mFramer.pendingData(), mFramer.pending());
+  return false;
+}
+
+// Answers a WebSocket opening handshake. Browsers cannot open a raw socket,
+// so this lets them signal without a relay in front of the player.
+bool
+SocketHandler::Upgrade()
+{
+  std::string response;
+  bool valid = false;
+  const size_t used = websocket::Handshake(mFramer.pendingData(), mFramer.pending(), response, valid);
+  if (!used) {
+    return false;
+  }
+
+  mFramer.discard(used);
+  Write(response.c_str(), response.length(), -1);
+  if (!valid) {
+    LOG("ERROR: Rejected WebSocket handshake.\n");
+    close(NS_BASE_STREAM_CLOSED);
+    mClosed = true;
+    return false;
+  }
+
+  mNegotiated = true;
+  mFramer.setMode(Framer::FrameWebSocket);
+  mState->mWriter->setMode(Framer::FrameWebSocket);
+  LOG("Using WebSocket signaling\n");
+  return true;
+}
+
+// Handles WebSocket control frames on the socket thread. They never reach
+// the message queue.
+void
+SocketHandler::Control(const FrameSlice& aSlice)
+{
+  const char* payload = mFramer.data() + aSlice.offset;
+  switch (aSlice.opcode) {
+  case websocket::OpPing:
+    Write(payload, aSlice.length, websocket::OpPong);
+    break;
+  case websocket::OpClose:
+    // Echo the status code back and drop the connection.
+    LOG("WebSocket closed by peer.\n");
+    Write(payload, (aSlice.length < 2 ? aSlice.length : 2), websocket::OpClose);
+    close(NS_BASE_STREAM_CLOSED);
+    mClosed = true;
+    break;
+  default:
+    break;
+  }
+}
+
+// Sends from the socket thread, where write polling can be enabled directly.
+// A negative aOpcode writes aData without framing.
+void
+SocketHandler::Write(const char* aData, size_t aLength, int aOpcode)
+{
+  SignalWriter::Result result = (aOpcode < 0 ?
+    mState->mWriter->write(aData, aLength) :
+    mState->mWriter->send(aData, aLength, (uint8_t)aOpcode));
+  if (result == SignalWriter::StartPolling) {
+    watchForWrite();
+  }
+  else if ((result == SignalWriter::Failed) && !mClosed) {
+    LOG("ERROR: Failed to send on signaling connection.\n");
+    close(NS_BASE_STREAM_CLOSED);
+    mClosed = true;
+  }
+}
+
 void
 SocketHandler::OnSocketDetached(PRFileDesc *fd)
 {
   LOG("Socket Detached!\n");
   if (fd == mState->mSocket) {
+    mState->mWriter->setSocket(nullptr);
     PR_Close(fd);
     mState->mSocket = 0;
   }
+  mozilla::RefPtr<EndSession> end = new EndSession(mState);
+  NS_DispatchToMainThread(end);
+}
+
+void
+ListenHandler::OnSocketReady(PRFileDesc *fd, int16_t outFlags)
+{
+  if (outFlags & PR_POLL_READ) {
+    while (true) {
+      PRNetAddr addr;
+      PRFileDesc* socket = PR_Accept(fd, &addr, PR_INTERVAL_NO_WAIT);
+      if (!socket) {
+        PRErrorCode error = PR_GetError();
+        if ((error != PR_WOULD_BLOCK_ERROR) && (error != PR_IO_TIMEOUT_ERROR)) {
+          LogPRError();
+        }
+        break;
+      }
+      mozilla::RefPtr<StartSession> start = new StartSession(socket);
+      NS_DispatchToMainThread(start);
+    }
+  }
+  if (outFlags & (PR_POLL_ERR | PR_POLL_NVAL)) {
+    LOG("ERROR: Signaling listener failed.\n");
+    close(NS_BASE_STREAM_CLOSED);
+  }
+}
+
+void
+ListenHandler::OnSocketDetached(PRFileDesc *fd)
+{
+  LOG("Listener Detached!\n");
+  PR_Close(fd);
+  mozilla::RefPtr<StopListening> stop = new StopListening;
+  NS_DispatchToMainThread(stop);
+}
+
+// The session's generators write into the writer's message buffer, so
+// messages go out without being copied or allocating.
+JSONGenerator&
+BeginJSON(State* aState)
+{
+  aState->mWriter->beginMessage();
+  aState->mGenerator.clear();
+  return aState->mGenerator;
+}
+
+CBORGenerator&
+BeginCBOR(State* aState)
+{
+  aState->mWriter->beginMessage();
+  aState->mCBORGenerator.clear();
+  return aState->mCBORGenerator;
+}
+
+// Must be called on the main thread. Returns the size of the message sent.
+size_t
+SendOutput(State* aState)
+{
+  const size_t length = aState->mWriter->message().length() - websocket::sMaxServerHeader;
+  HandleSendResult(aState, aState->mWriter->sendMessage());
+  return length;
+}
+
+template<class Generator>
+void
+SendAnswer(State* aState, Generator& aGen, const char* aAnswer)
+{
+  aGen.openMap();
+  aGen.addPair("type", "answer");
+  aGen.addPair("sdp", aAnswer);
+  aGen.closeMap();
+  SendOutput(aState);
 }
 
 NS_IMETHODIMP
@@ -269,15 +761,11 @@ PCObserver::OnCreateAnswerSuccess(const char* answer, ER&)
   if (answer && mState.get() && mState->mSocket && mState->mPeerConnection.get()) {
     mState->mPeerConnection->SetLocalDescription(PCANSWER, answer);
     LOG("Answer ->\n%s\n", answer);
-    JSONGenerator gen;
-    gen.openMap();
-    gen.addPair("type", std::string("answer"));
-    gen.addPair("sdp", std::string(answer));
-    gen.closeMap();
-    std::string value;
-    if (gen.getJSON(value)) {
-      PR_Send(mState->mSocket, value.c_str(), value.length(), 0, PR_INTERVAL_NO_TIMEOUT);
-      PR_Send(mState->mSocket, JSONTerminator, JSONTerminatorSize, 0, PR_INTERVAL_NO_TIMEOUT);
+    if (mState->mEncoding == EncodingCBOR) {
+      SendAnswer(mState, BeginCBOR(mState), answer);
+    }
+    else {
+      SendAnswer(mState, BeginJSON(mState), answer);
     }
   }
 
@@ -356,31 +844,93 @@ PCObserver::OnRemoveStream(ER&)
   return NS_OK;
 }
 
+template<class Generator>
+void
+AddCandidate(Generator& aGen, const Candidate& aCandidate)
+{
+  aGen.openMap();
+  aGen.addPair("candidate", aCandidate.mCandidate);
+  aGen.addPair("sdpMid", aCandidate.mMid);
+  aGen.addPair("sdpMLineIndex", aCandidate.mIndex);
+  aGen.closeMap();
+}
+
+template<class Generator>
+void
+SendCandidates(State* aState, Generator& aGen)
+{
+  if (aState->mCandidates.size() == 1) {
+    AddCandidate(aGen, aState->mCandidates[0]);
+  }
+  else {
+    aGen.openArray();
+    for (size_t ix = 0; ix < aState->mCandidates.size(); ix++) {
+      AddCandidate(aGen, aState->mCandidates[ix]);
+    }
+    aGen.closeArray();
+  }
+  aState->mCandidates.clear();
+
+  const size_t length = SendOutput(aState);
+  if (length) {
+    LOG("Sending %d byte candidate message\n", (int)length);
+  }
+}
+
+void
+SendCandidates(State* aState)
+{
+  if (aState->mCandidates.empty()) {
+    return;
+  }
+
+  if (aState->mEncoding == EncodingCBOR) {
+    SendCandidates(aState, BeginCBOR(aState));
+  }
+  else {
+    SendCandidates(aState, BeginJSON(aState));
+  }
+}
+
 NS_IMETHODIMP
 PCObserver::OnIceCandidate(uint16_t level, const char *mid, const char *cand, ER&) {
   if (cand && (cand[0] != '\0')) {
     LOG("OnIceCandidate: candidate: %s mid: %s level: %d\n", cand, mid, (int)level);
-    JSONGenerator gen;
-    gen.openMap();
-    gen.addPair("candidate", std::string(cand));
-    gen.addPair("sdpMid", std::string(mid));
-    gen.addPair("sdpMLineIndex", (int)level - 1);
-    gen.closeMap();
-    std::string value;
-    if (gen.getJSON(value)) {
-      LOG("Sending candidate JSON: %s\n", value.c_str());
-      PRInt32 amount = PR_Send(mState->mSocket, value.c_str(), value.length(), 0, PR_INTERVAL_NO_TIMEOUT);
-      if (amount < (PRInt32)value.length()) {
-        LogPRError();
-      }
-      amount = PR_Send(mState->mSocket, JSONTerminator, JSONTerminatorSize, 0, PR_INTERVAL_NO_TIMEOUT);
-      if (amount < JSONTerminatorSize) {
-        LogPRError();
+    Candidate candidate;
+    candidate.mCandidate = cand;
+    candidate.mMid = mid;
+    candidate.mIndex = (int)level - 1;
+    mState->mCandidates.push_back(candidate);
+    if (sCandidateBatchMs <= 0) {
+      SendCandidates(mState);
+    }
+    else if (mState->mCandidates.size() == 1) {
+      if (!mState->mCandidateTimer) {
+        mState->mCandidateTimer = media::CreateTimer();
       }
+      mozilla::RefPtr<CandidateTimer> callback = new CandidateTimer(mState);
+      mState->mCandidateTimer->InitWithCallback(
+        callback,
+        PR_MillisecondsToInterval(sCandidateBatchMs),
+        media::Timer::TYPE_ONE_SHOT);
     }
   }
   else {
+    // Gathering is done, so there is no point holding back the last batch.
     LOG("OnIceCandidate ignoring null ice candidate\n");
+    if (mState->mCandidateTimer) {
+      mState->mCandidateTimer->Cancel();
+    }
+    SendCandidates(mState);
+  }
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+CandidateTimer::Notify(media::Timer *timer)
+{
+  if (mState.get()) {
+    SendCandidates(mState);
   }
   return NS_OK;
 }
@@ -392,14 +942,54 @@ PullTimer::Notify(media::Timer *timer)
     Fake_DOMMediaStream* fake = reinterpret_cast<Fake_DOMMediaStream*>(mState->mStream.get());
     if (fake) {
       Fake_MediaStream* ms = reinterpret_cast<Fake_MediaStream*>(fake->GetStream());
-      static uint64_t value = 0;
-      if (ms) { ms->NotifyPull(nullptr, value++); }
+      if (ms) { ms->NotifyPull(nullptr, mPulled++); }
     }
   }
   return NS_OK;
 }
 
-typedef std::vector<std::string>::size_type vsize_t;
+// Fills aSignal from the top level object when aElement is negative,
+// otherwise from the object at that element of a batch.
+template<class Parser>
+void
+ExtractSignal(Parser& aParse, int aElement, SignalMessage& aSignal)
+{
+  aSignal.clear();
+  if (aElement < 0) {
+    if (aParse.find("type", aSignal.type)) { aSignal.fields |= SignalMessage::FieldType; }
+    if (aParse.find("sdp", aSignal.sdp)) { aSignal.fields |= SignalMessage::FieldSdp; }
+    if (aParse.find("candidate", aSignal.candidate)) { aSignal.fields |= SignalMessage::FieldCandidate; }
+    if (aParse.find("sdpMid", aSignal.sdpMid)) { aSignal.fields |= SignalMessage::FieldSdpMid; }
+    if (aParse.find("sdpMLineIndex", aSignal.sdpMLineIndex)) { aSignal.fields |= SignalMessage::FieldSdpMLineIndex; }
+  }
+  else {
+    if (aParse.find(aElement, "type", aSignal.type)) { aSignal.fields |= SignalMessage::FieldType; }
+    if (aParse.find(aElement, "sdp", aSignal.sdp)) { aSignal.fields |= SignalMessage::FieldSdp; }
+    if (aParse.find(aElement, "candidate", aSignal.candidate)) { aSignal.fields |= SignalMessage::FieldCandidate; }
+    if (aParse.find(aElement, "sdpMid", aSignal.sdpMid)) { aSignal.fields |= SignalMessage::FieldSdpMid; }
+    if (aParse.find(aElement, "sdpMLineIndex", aSignal.sdpMLineIndex)) { aSignal.fields |= SignalMessage::FieldSdpMLineIndex; }
+  }
+}
+
+void
+ApplyCandidate(State* aState, const SignalMessage& aSignal, const char* aMessage)
+{
+  const bool hasCandidate = aSignal.has(SignalMessage::FieldCandidate);
+  const bool hasMid = aSignal.has(SignalMessage::FieldSdpMid);
+  const bool hasIndex = aSignal.has(SignalMessage::FieldSdpMLineIndex);
+
+  if (hasCandidate && hasMid && hasIndex) {
+    if (!aSignal.candidate.empty()) {
+      aState->mPeerConnection->AddIceCandidate(aSignal.candidate.c_str(), aSignal.sdpMid.c_str(), (unsigned short)aSignal.sdpMLineIndex + 1);
+    }
+    else {
+      LOG("ERROR: Received NULL ice candidate:\n%s\n", aMessage);
+    }
+  }
+  else {
+    LOG("ERROR: Ice candidate failed to parse: %s candidate:%s sdpMid:%s sdpMLineIndex:%s\n", aMessage, (hasCandidate ? "True" : "False"), (hasMid ? "True" : "False"), (hasIndex ? "True" : "False"));
+  }
+}
 
 nsresult
 ProcessMessage::Run()
@@ -409,38 +999,172 @@ ProcessMessage::Run()
     return NS_ERROR_FAILURE;
   }
 
-  const vsize_t size = mMessageList.size();
-  for (vsize_t ix = 0; ix < size; ix++) {
-    std::string message = mMessageList[ix];
-    JSONParser parse(message.c_str());
-    std::string type;
-    if (parse.find("type", type)) {
-      std::string sdp;
-      if ((type == "offer") && parse.find("sdp", sdp)) {
-        mState->mPeerConnection->SetRemoteDescription(PCOFFER, sdp.c_str());
-        mState->mPeerConnection->CreateAnswer();
-      }
-      else {
-        LOG("ERROR: Failed to parse offer:\n%s\n", message.c_str());
-      }
-    }
-    else {
-      std::string candidate, mid;
-      int index = 0;
-      if (parse.find("candidate", candidate) && parse.find("sdpMid", mid) && parse.find("sdpMLineIndex", index)) {
-        if (candidate[0] != '\0') {
-          mState->mPeerConnection->AddIceCandidate(candidate.c_str(), mid.c_str(), (unsigned short)index + 1);
+  MessageQueue* queue = mState->mQueue;
+  do {
+    MessageBatch* batch = nullptr;
+    while ((batch = queue->peek())) {
+      const size_t size = batch->mMessages.size();
+      const bool decoded = !batch->mSignalCounts.empty();
+      size_t signal = 0;
+      for (size_t ix = 0; (ix < size) && mState->mPeerConnection; ix++) {
+        const char* message = batch->mBuffer.data() + batch->mMessages[ix].offset;
+        if (!decoded) {
+          HandleMessage(message, batch->mMessages[ix].length);
+          continue;
         }
-        else {
-          LOG("ERROR: Received NULL ice candidate:\n%s\n", message.c_str());
+        // Already decoded by the socket thread as it arrived.
+        for (int count = batch->mSignalCounts[ix]; count > 0; count--) {
+          HandleSignal(batch->mSignals[signal++], message);
         }
       }
-      else {
-        LOG("ERROR: Ice candidate failed to parse: %s candidate:%s sdpMid:%s sdpMLineIndex:%s\n", message.c_str(), (parse.find("candidate", candidate) ? "True" : "False"), (parse.find("sdpMid", mid) ? "True" : "False"), (parse.find("sdpMLineIndex", index) ? "True" : "False"));
+      if (queue->pop() && mState->mHandler) {
+        mozilla::RefPtr<ResumePublish> resume = new ResumePublish(mState->mHandler);
+        transport::Dispatch(resume);
       }
     }
+  } while (queue->finishDrain());
+
+  return NS_OK;
+}
+
+void
+ProcessMessage::HandleMessage(const char* aMessage, size_t aLength)
+{
+  if (mState->mEncoding == EncodingCBOR) {
+    CBORParser parse(aMessage, aLength);
+    const int count = parse.length();
+    for (int element = 0; element < count; element++) {
+      ExtractSignal(parse, element, mSignal);
+      HandleSignal(mSignal, "[CBOR message]");
+    }
+    if (count == 0) {
+      ExtractSignal(parse, -1, mSignal);
+      HandleSignal(mSignal, "[CBOR message]");
+    }
+    return;
+  }
+
+  // A batch of trickled candidates decodes to several messages.
+  const int count = mDecoder.decode(aMessage, aLength);
+  if (count < 0) {
+    LOG("ERROR: Failed to parse signaling message: %s\n%s\n", mDecoder.error().c_str(), aMessage);
+  }
+  for (int ix = 0; ix < count; ix++) {
+    HandleSignal(mDecoder.message(ix), aMessage);
+  }
+}
+
+void
+ProcessMessage::HandleSignal(const SignalMessage& aSignal, const char* aMessage)
+{
+  if (aSignal.has(SignalMessage::FieldType)) {
+    if ((aSignal.type == "offer") && aSignal.has(SignalMessage::FieldSdp)) {
+      mState->mPeerConnection->SetRemoteDescription(PCOFFER, aSignal.sdp.c_str());
+      mState->mPeerConnection->CreateAnswer();
+    }
+    else {
+      LOG("ERROR: Failed to parse offer:\n%s\n", aMessage);
+    }
+  }
+  else {
+    ApplyCandidate(mState, aSignal, aMessage);
+  }
+}
+
+nsresult
+StartSession::Run()
+{
+  if (!sListening || ((int)sSessions.size() >= sMaxSessions)) {
+    LOG("Refusing signaling connection, %d of %d sessions active.\n", (int)sSessions.size(), sMaxSessions);
+    PR_Close(mSocket);
+    return NS_OK;
+  }
+
+  mozilla::RefPtr<State> state = new State;
+  state->mSocket = mSocket;
+
+  // Nothing on the main thread may block on the signaling socket, and small
+  // answers and candidates should not wait on Nagle.
+  PRSocketOptionData opt;
+  opt.option = PR_SockOpt_Nonblocking;
+  opt.value.non_blocking = true;
+  PR_SetSocketOption(state->mSocket, &opt);
+  opt.option = PR_SockOpt_NoDelay;
+  opt.value.no_delay = true;
+  PR_SetSocketOption(state->mSocket, &opt);
+  state->mWriter->setSocket(state->mSocket);
+
+  sipcc::IceConfiguration cfg;
+
+  state->mPeerConnection = sipcc::PeerConnectionImpl::CreatePeerConnection();
+  state->mPeerConnectionObserver = new PCObserver(state);
+  state->mPeerConnection->Initialize(*(state->mPeerConnectionObserver), nullptr, cfg, NS_GetCurrentThread());
+
+  mozilla::RefPtr<PullTimer> pull = new PullTimer(state);
+  state->mPullTimer = media::CreateTimer();
+  state->mPullTimer->InitWithCallback(
+    pull,
+    PR_MillisecondsToInterval(16),
+    media::Timer::TYPE_REPEATING_PRECISE);
+
+  state->mHandler = new SocketHandler(state);
+  transport::Attach(state->mSocket, state->mHandler);
+
+  sSessions.push_back(state);
+  LOG("Started session %d of %d.\n", (int)sSessions.size(), sMaxSessions);
+  return NS_OK;
+}
+
+// Tears down everything a session owns. The signaling socket itself is
+// closed when the socket thread detaches it.
+void
+CloseSession(State* aState)
+{
+  MessageQueue* queue = aState->mQueue;
+  LOG("Signaling queue: %u messages in %u batches, max depth %u, latency mean %u us max %u us\n",
+      queue->messages(), queue->batches(), queue->maxDepth(), queue->meanLatency(), queue->maxLatency());
+  LOG("Video sink: %u frames published, %u superseded before drawing, %u dropped\n",
+      (uint32_t)aState->mFramesQueued, (uint32_t)aState->mFramesSuperseded, (uint32_t)aState->mFramesDropped);
+
+  if (aState->mPullTimer) {
+    aState->mPullTimer->Cancel();
+    aState->mPullTimer = nullptr;
   }
+  if (aState->mCandidateTimer) {
+    aState->mCandidateTimer->Cancel();
+    aState->mCandidateTimer = nullptr;
+  }
+  if (aState->mStream) {
+    aState->mStream->GetStream()->AsSourceStream()->StopStream();
+    aState->mStream = nullptr;
+  }
+  if (aState->mPeerConnection) {
+    aState->mPeerConnection->CloseStreams();
+    aState->mPeerConnection->Close();
+    aState->mPeerConnection = nullptr;
+  }
+  aState->mPeerConnectionObserver = nullptr;
+  aState->mHandler = nullptr;
+}
+
+nsresult
+EndSession::Run()
+{
+  for (size_t ix = 0; ix < sSessions.size(); ix++) {
+    if (sSessions[ix].get() == mState.get()) {
+      CloseSession(mState);
+      sSessions.erase(sSessions.begin() + ix);
+      LOG("Ended session, %d still active.\n", (int)sSessions.size());
+      break;
+    }
+  }
+  return NS_OK;
+}
 
+nsresult
+StopListening::Run()
+{
+  sListening = false;
   return NS_OK;
 }
 
@@ -466,21 +1190,43 @@ CheckPRError(PRStatus result)
   return true;
 }
 
+// Matches "--name=value" and stores the integer value.
+bool
+ParseOption(const char* aArg, const char* aName, int& aValue)
+{
+  const size_t length = strlen(aName);
+  if ((strncmp(aArg, "--", 2) == 0) && (strncmp(aArg + 2, aName, length) == 0) && (aArg[length + 2] == '=')) {
+    aValue = atoi(aArg + length + 3);
+    return true;
+  }
+  return false;
+}
+
 int
 main(int argc, char* argv[])
 {
+  for (int ix = 1; ix < argc; ix++) {
+    ParseOption(argv[ix], "candidate-batch-ms", sCandidateBatchMs);
+    ParseOption(argv[ix], "max-sessions", sMaxSessions);
+    ParseOption(argv[ix], "epoll", sEpoll);
+  }
+
   media::Initialize();
   NSS_NoDB_Init(nullptr);
   NSS_SetDomesticPolicy();
-  mozilla::RefPtr<State> state = new State;
+
+  if (sEpoll && !transport::UseEpoll()) {
+    LOG("WARNING: epoll is not available, using the socket transport service.\n");
+  }
 
   PRNetAddr addr;
   memset(&addr, 0, sizeof(addr));
-  PR_SetNetAddr(PR_IpAddrAny, PR_AF_INET, 8011, &addr);
+  PR_SetNetAddr(PR_IpAddrAny, PR_AF_INET, sSignalingPort, &addr);
   PRFileDesc* sock = PR_OpenTCPSocket(PR_AF_INET);
 
   if (!sock) {
     LOG("ERROR: Failed to create socket\n.");
+    exit(-1);
   }
 
   PRSocketOptionData opt;
@@ -489,51 +1235,29 @@ main(int argc, char* argv[])
   opt.value.reuse_addr = true;
   PR_SetSocketOption(sock, &opt);
 
-  CheckPRError(PR_Bind(sock, &addr));
+  opt.option = PR_SockOpt_Nonblocking;
+  opt.value.non_blocking = true;
+  PR_SetSocketOption(sock, &opt);
 
-  if (CheckPRError(PR_Listen(sock, 5))) {
-    state->mSocket = PR_Accept(sock, &addr, PR_INTERVAL_NO_TIMEOUT);
-    PR_Shutdown(sock, PR_SHUTDOWN_BOTH);
-    PR_Close(sock);
-    sock = nullptr;
-  }
-  else {
-    exit(-1);
-  }
+  CheckPRError(PR_Bind(sock, &addr));
 
-  if (!state->mSocket) {
-    LOG("ERROR: Failed to create socket\n");
+  if (!CheckPRError(PR_Listen(sock, 5))) {
     exit(-1);
   }
 
-  sipcc::IceConfiguration cfg;
-
-  state->mPeerConnection = sipcc::PeerConnectionImpl::CreatePeerConnection();
-  state->mPeerConnectionObserver = new PCObserver(state);
-  state->mPeerConnection->Initialize(*(state->mPeerConnectionObserver), nullptr, cfg, NS_GetCurrentThread());
-
-  mozilla::RefPtr<media::Timer> timer = media::CreateTimer();;
-  mozilla::RefPtr<PullTimer> pull = new PullTimer(state);
-
-  timer->InitWithCallback(
-    pull,
-    PR_MillisecondsToInterval(16),
-    media::Timer::TYPE_REPEATING_PRECISE);
-
-  mozilla::RefPtr<SocketHandler> handler = new SocketHandler(state);
-  mozilla::RefPtr<DispatchSocketHandler> dispatch = new DispatchSocketHandler(state->mSocket, handler);
-  mozilla::RefPtr<media::EventTarget> sts = media::GetSocketTransportServiceTarget();
-  sts->Dispatch(dispatch, MEDIA_DISPATCH_NORMAL);
+  mozilla::RefPtr<ListenHandler> listener = new ListenHandler;
+  transport::Attach(sock, listener);
 
   render::Initialize();
-  while (render::KeepRunning()) { NS_ProcessNextEvent(nullptr, true); }
+  while (sListening) { NS_ProcessNextEvent(nullptr, true); }
 
-  if (state->mStream) { state->mStream->GetStream()->AsSourceStream()->StopStream(); }
-  state->mPeerConnection->CloseStreams();
-  state->mPeerConnection->Close();
-  state->mPeerConnection = nullptr;
+  for (size_t ix = 0; ix < sSessions.size(); ix++) {
+    CloseSession(sSessions[ix]);
+  }
+  sSessions.clear();
 
   render::Shutdown();
+  transport::Shutdown();
   media::Shutdown();
 
   return 0;
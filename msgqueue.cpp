@@ -0,0 +1,78 @@
+#include "msgqueue.h"
+
+MessageQueue::MessageQueue() :
+  mHead(0),
+  mTail(0),
+  mScheduled(0),
+  mStalled(0),
+  mMaxDepth(0),
+  mBatches(0),
+  mMessageCount(0),
+  mLatencyTotal(0),
+  mLatencyMax(0) {}
+
+MessageBatch*
+MessageQueue::beginPublish()
+{
+  if ((mTail - mHead) >= sCapacity) {
+    mStalled = 1;
+    // The consumer may have freed a slot before it could see the flag.
+    if ((mTail - mHead) >= sCapacity) {
+      return NULL;
+    }
+    mStalled = 0;
+  }
+  return &mSlots[mTail % sCapacity];
+}
+
+bool
+MessageQueue::endPublish()
+{
+  mSlots[mTail % sCapacity].mPublished = PR_IntervalNow();
+  mTail++;
+  const uint32_t current = mTail - mHead;
+  if (current > mMaxDepth) {
+    mMaxDepth = current;
+  }
+  return mScheduled.exchange(1) == 0;
+}
+
+MessageBatch*
+MessageQueue::peek()
+{
+  if (mHead == mTail) {
+    return NULL;
+  }
+  MessageBatch& batch = mSlots[mHead % sCapacity];
+  const uint32_t latency = PR_IntervalToMicroseconds(PR_IntervalNow() - batch.mPublished);
+  mBatches++;
+  mMessageCount += batch.mMessages.size();
+  mLatencyTotal += latency;
+  if (latency > mLatencyMax) {
+    mLatencyMax = latency;
+  }
+  return &batch;
+}
+
+bool
+MessageQueue::pop()
+{
+  MessageBatch& batch = mSlots[mHead % sCapacity];
+  batch.mBuffer.clear();
+  batch.mMessages.clear();
+  // mSignals keeps its entries so their strings are reused.
+  batch.mSignalCounts.clear();
+  mHead++;
+  return mStalled.exchange(0) != 0;
+}
+
+bool
+MessageQueue::finishDrain()
+{
+  mScheduled = 0;
+  if (mHead == mTail) {
+    return false;
+  }
+  // Keep going unless the producer already scheduled another drain.
+  return mScheduled.exchange(1) == 0;
+}
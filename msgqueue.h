@@ -0,0 +1,75 @@
+#ifndef MSGQUEUE_DOT_H
+#define MSGQUEUE_DOT_H
+
+#include <stdint.h>
+
+#include "mozilla/Atomics.h"
+#include "MediaRefCount.h"
+
+#include "prinrval.h"
+
+#include "framer.h"
+#include "json.h"
+
+// The messages completed by one socket read.
+struct MessageBatch {
+  FrameBuffer mBuffer;
+  FrameSliceList mMessages;
+  PRIntervalTime mPublished;
+  // Filled instead when the socket thread decodes messages as they arrive.
+  // mSignalCounts[ix] of mSignals, in order, came from mMessages[ix].
+  std::vector<SignalMessage> mSignals;
+  std::vector<int> mSignalCounts;
+};
+
+// Bounded single producer, single consumer ring of preallocated batches
+// from the socket thread to the main thread. Slots keep their buffers when
+// recycled, so once they have grown to the usual message size passing a
+// message along does not touch the heap.
+class MessageQueue {
+MEDIA_REF_COUNT_INLINE
+public:
+  static const uint32_t sCapacity = 16;
+
+  MessageQueue();
+
+  // Producer. Returns the slot to fill, or NULL when the ring is full, in
+  // which case the consumer will ask for a resume once it frees a slot.
+  MessageBatch* beginPublish();
+  // Returns true when the consumer needs a wakeup.
+  bool endPublish();
+
+  // Consumer. Returns the oldest batch, or NULL when the ring is empty.
+  // Call once per batch, it also records the batch's latency.
+  MessageBatch* peek();
+  // Recycles the batch returned by peek(). Returns true when the producer
+  // stalled on a full ring and must be resumed.
+  bool pop();
+  // Called when the consumer runs out of batches. Returns true if more were
+  // published meanwhile and the consumer should keep going.
+  bool finishDrain();
+
+  uint32_t depth() const { return mTail - mHead; }
+  uint32_t maxDepth() const { return mMaxDepth; }
+  uint32_t batches() const { return mBatches; }
+  uint32_t messages() const { return mMessageCount; }
+  // Dispatch to run latency, in microseconds.
+  uint32_t meanLatency() const { return mBatches ? (uint32_t)(mLatencyTotal / mBatches) : 0; }
+  uint32_t maxLatency() const { return mLatencyMax; }
+
+protected:
+  MessageBatch mSlots[sCapacity];
+  mozilla::Atomic<uint32_t> mHead;
+  mozilla::Atomic<uint32_t> mTail;
+  mozilla::Atomic<uint32_t> mScheduled;
+  mozilla::Atomic<uint32_t> mStalled;
+  mozilla::Atomic<uint32_t> mMaxDepth;
+
+  // Only touched by the consumer.
+  uint32_t mBatches;
+  uint32_t mMessageCount;
+  uint64_t mLatencyTotal;
+  uint32_t mLatencyMax;
+};
+
+#endif // #define MSGQUEUE_DOT_H
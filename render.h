@@ -3,10 +3,24 @@
 
 namespace render {
 
+enum PublishResult {
+  // Waiting for the render thread.
+  PublishQueued,
+  // Replaced a frame the render thread had not taken yet.
+  PublishSuperseded,
+  // Not handed over, the renderer is not running, the picture is too small
+  // for its size or another sink was publishing at the same time.
+  PublishDropped
+};
+
+// Starts the render thread, which creates and owns the EGL context.
 void Initialize();
+// Stops and joins the render thread.
 void Shutdown();
-void Draw(const unsigned char* aImage, int size, int aWidth, int aHeight);
-bool KeepRunning();
+// Hands an I420 picture to the render thread, which draws only the newest
+// one it has. Copies the image and never blocks, so it is safe to call from
+// the media thread.
+PublishResult Publish(const unsigned char* aImage, unsigned int aSize, int aWidth, int aHeight);
 
-} // namespace standalone
+} // namespace render
 #endif // ifndef media_render_dot_h_
@@ -1,8 +1,15 @@
 #include <EGL/egl.h>
 #include <GLES2/gl2.h>
+#include <errno.h>
+#include <semaphore.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include "prtime.h"
+#include <string.h>
+
+#include "prthread.h"
+
+#include "mailbox.h"
+#include "render.h"
 
 static EGLNativeWindowType sNativeWin = 0;
 static EGLDisplay sEGLDisplay;
@@ -18,7 +25,13 @@ static GLuint sShaderProgram;
 static int sWidth;
 static int sHeight;
 static GLint sPosAttrib;
-static PRTime sLastUpdate;
+
+// The render thread is the only one to touch EGL or GL. Sinks hand it frames
+// through sMailbox and post sWake when one arrives to an empty mailbox.
+static PRThread* sThread;
+static FrameMailbox* sMailbox;
+static sem_t sWake;
+static mozilla::Atomic<uint32_t> sStopping;
 
 static GLfloat sVertices[] = {
   -1.0f, -1.0f,
@@ -168,10 +181,10 @@ const GLchar *fragmentSource =
   "}\n";
 
 
-namespace render {
+namespace {
 
 void
-Initialize()
+InitializeGL()
 {
   static const EGLint configAttribs[] = {
     EGL_RENDERABLE_TYPE,     EGL_OPENGL_ES2_BIT,
@@ -320,7 +333,6 @@ Initialize()
 void
 Draw(const unsigned char* aImage, int size, int aWidth, int aHeight)
 {
-  RLOG("Got %d x %d size: %d\n", aWidth, aHeight, size);
 
   if ((aWidth > 0) && (aHeight > 0)) {
 
@@ -360,23 +372,109 @@ Draw(const unsigned char* aImage, int size, int aWidth, int aHeight)
     GL_CHECK(glClear(GL_COLOR_BUFFER_BIT));
     GL_CHECK(glDrawArrays(GL_TRIANGLE_FAN, 0, 4));
     GL_CHECK(eglSwapBuffers(sEGLDisplay, sEGLWindowSurface));
+  }
+}
+
+void
+ShutdownGL()
+{
+  GL_CHECK(glDeleteTextures(1, &sTextureY));
+  GL_CHECK(glDeleteTextures(1, &sTextureU));
+  GL_CHECK(glDeleteTextures(1, &sTextureV));
+  GL_CHECK(glDeleteProgram(sShaderProgram));
+  GL_CHECK(glDeleteShader(sFragmentShader));
+  GL_CHECK(glDeleteShader(sVertexShader));
+  EGL_CHECK(eglMakeCurrent(sEGLDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT));
+  EGL_CHECK(eglDestroySurface(sEGLDisplay, sEGLWindowSurface));
+  EGL_CHECK(eglDestroyContext(sEGLDisplay, sEGLContext));
+  EGL_CHECK(eglTerminate(sEGLDisplay));
+}
+
+void
+ThreadFunc(void*)
+{
+  PR_SetCurrentThreadName("Render");
+  // The context is created and made current here, so it stays with this
+  // thread for its whole life.
+  InitializeGL();
+
+  while (true) {
+    while ((sem_wait(&sWake) < 0) && (errno == EINTR)) {}
+    if (sStopping) {
+      break;
+    }
+    // However many frames arrived since the last wakeup, only the newest
+    // is drawn.
+    VideoFrameSlot* frame = sMailbox->take();
+    if (!frame) {
+      continue;
+    }
+    const int size = (int)frame->mImage.size();
+    if ((frame->mWidth <= 0) || (frame->mHeight <= 0)) {
+      sMailbox->consumerDrop();
+      continue;
+    }
+    Draw(&frame->mImage[0], size, frame->mWidth, frame->mHeight);
+  }
+
+  ShutdownGL();
+}
 
-    sLastUpdate = PR_Now();
+} // namespace
+
+namespace render {
+
+void
+Initialize()
+{
+  sMailbox = new FrameMailbox;
+  sStopping = 0;
+  sem_init(&sWake, 0, 0);
+  sThread = PR_CreateThread(PR_USER_THREAD, ThreadFunc, nullptr, PR_PRIORITY_HIGH, PR_GLOBAL_THREAD, PR_JOINABLE_THREAD, 0);
+  if (!sThread) {
+    RLOG("ERROR: Failed to create render thread\n");
   }
 }
 
-bool
-KeepRunning()
+PublishResult
+Publish(const unsigned char* aImage, unsigned int aSize, int aWidth, int aHeight)
 {
-  return (sLastUpdate == 0) || ((PR_Now() - sLastUpdate) < 5000000);
+  // An I420 picture is a full size Y plane and quarter size U and V planes.
+  if (!sThread || sStopping || !aImage || (aWidth <= 0) || (aHeight <= 0) ||
+      (aSize < (unsigned int)(aWidth * aHeight + 2 * (aWidth / 2) * (aHeight / 2)))) {
+    return PublishDropped;
+  }
+  VideoFrameSlot* slot = sMailbox->beginPublish();
+  if (!slot) {
+    return PublishDropped;
+  }
+  // Slots keep their buffers, so this only allocates when the picture grows.
+  slot->mImage.resize(aSize);
+  memcpy(&slot->mImage[0], aImage, aSize);
+  slot->mWidth = aWidth;
+  slot->mHeight = aHeight;
+  if (!sMailbox->endPublish()) {
+    return PublishSuperseded;
+  }
+  sem_post(&sWake);
+  return PublishQueued;
 }
 
 void
 Shutdown()
 {
-  GL_CHECK(glDeleteProgram(sShaderProgram));
-  GL_CHECK(glDeleteShader(sFragmentShader));
-  GL_CHECK(glDeleteShader(sVertexShader));
+  if (sThread) {
+    sStopping = 1;
+    sem_post(&sWake);
+    PR_JoinThread(sThread);
+    sThread = nullptr;
+    RLOG("Render: %u frames published, %u superseded, %u dropped; %u drawn, %u superseded, %u dropped\n",
+         sMailbox->published(), sMailbox->producerSuperseded(), sMailbox->producerDropped(),
+         sMailbox->taken() - sMailbox->consumerDropped(), sMailbox->consumerSuperseded(), sMailbox->consumerDropped());
+  }
+  sem_destroy(&sWake);
+  delete sMailbox;
+  sMailbox = nullptr;
 }
 
-}
+} // namespace render
@@ -0,0 +1,121 @@
+#include "scan.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+size_t
+FindPairScalar(const char* aData, size_t aOffset, size_t aLength, char aFirst, char aSecond)
+{
+  while ((aOffset + 1) < aLength) {
+    const char* found = (const char*)memchr(aData + aOffset, aFirst, aLength - aOffset - 1);
+    if (!found) {
+      break;
+    }
+    aOffset = found - aData;
+    if (aData[aOffset + 1] == aSecond) {
+      return aOffset;
+    }
+    aOffset++;
+  }
+  return aLength;
+}
+
+} // namespace
+
+namespace scan {
+
+size_t
+FindPair(const char* aData, size_t aLength, char aFirst, char aSecond)
+{
+  size_t offset = 0;
+
+  // Each block compares aData[i] against aFirst and aData[i + 1] against
+  // aSecond, so the last byte is left for the scalar tail.
+#if defined(__AVX2__)
+  const __m256i first = _mm256_set1_epi8(aFirst);
+  const __m256i second = _mm256_set1_epi8(aSecond);
+  // See the SSE2 loop below.
+  while ((offset + 128 + 1) <= aLength) {
+    const char* block = aData + offset;
+    __m256i found0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)block), first);
+    __m256i found1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(block + 32)), first);
+    __m256i found2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(block + 64)), first);
+    __m256i found3 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(block + 96)), first);
+    if (_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(found0, found1), _mm256_or_si256(found2, found3)))) {
+      found0 = _mm256_and_si256(found0, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(block + 1)), second));
+      found1 = _mm256_and_si256(found1, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(block + 33)), second));
+      found2 = _mm256_and_si256(found2, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(block + 65)), second));
+      found3 = _mm256_and_si256(found3, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(block + 97)), second));
+      const uint64_t low = (uint32_t)_mm256_movemask_epi8(found0) | ((uint64_t)(uint32_t)_mm256_movemask_epi8(found1) << 32);
+      const uint64_t high = (uint32_t)_mm256_movemask_epi8(found2) | ((uint64_t)(uint32_t)_mm256_movemask_epi8(found3) << 32);
+      if (low) {
+        return offset + __builtin_ctzll(low);
+      }
+      if (high) {
+        return offset + 64 + __builtin_ctzll(high);
+      }
+    }
+    offset += 128;
+  }
+  while ((offset + 32 + 1) <= aLength) {
+    __m256i current = _mm256_loadu_si256((const __m256i*)(aData + offset));
+    __m256i next = _mm256_loadu_si256((const __m256i*)(aData + offset + 1));
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+      _mm256_and_si256(_mm256_cmpeq_epi8(current, first), _mm256_cmpeq_epi8(next, second)));
+    if (mask) {
+      return offset + __builtin_ctz(mask);
+    }
+    offset += 32;
+  }
+#elif defined(__SSE2__)
+  const __m128i first = _mm_set1_epi8(aFirst);
+  const __m128i second = _mm_set1_epi8(aSecond);
+  // The first byte is rare in signaling text, so 64 bytes at a time are
+  // only checked for it, and pairs are only looked for in those that have
+  // it. A first byte without the second one, such as a stray CR, costs one
+  // more pass over the block and the loop goes on.
+  while ((offset + 64 + 1) <= aLength) {
+    const char* block = aData + offset;
+    __m128i found0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)block), first);
+    __m128i found1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(block + 16)), first);
+    __m128i found2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(block + 32)), first);
+    __m128i found3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(block + 48)), first);
+    if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(found0, found1), _mm_or_si128(found2, found3)))) {
+      found0 = _mm_and_si128(found0, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(block + 1)), second));
+      found1 = _mm_and_si128(found1, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(block + 17)), second));
+      found2 = _mm_and_si128(found2, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(block + 33)), second));
+      found3 = _mm_and_si128(found3, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(block + 49)), second));
+      const uint64_t mask = (uint64_t)_mm_movemask_epi8(found0) |
+                            ((uint64_t)_mm_movemask_epi8(found1) << 16) |
+                            ((uint64_t)_mm_movemask_epi8(found2) << 32) |
+                            ((uint64_t)_mm_movemask_epi8(found3) << 48);
+      if (mask) {
+        return offset + __builtin_ctzll(mask);
+      }
+    }
+    offset += 64;
+  }
+  while ((offset + 16 + 1) <= aLength) {
+    __m128i current = _mm_loadu_si128((const __m128i*)(aData + offset));
+    __m128i next = _mm_loadu_si128((const __m128i*)(aData + offset + 1));
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(
+      _mm_and_si128(_mm_cmpeq_epi8(current, first), _mm_cmpeq_epi8(next, second)));
+    if (mask) {
+      return offset + __builtin_ctz(mask);
+    }
+    offset += 16;
+  }
+#endif
+
+  return FindPairScalar(aData, offset, aLength, aFirst, aSecond);
+}
+
+} // namespace scan
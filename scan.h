@@ -0,0 +1,16 @@
+#ifndef SCAN_DOT_H
+#define SCAN_DOT_H
+
+#include <stddef.h>
+
+namespace scan {
+
+// Returns the offset of the first occurrence of aFirst immediately followed
+// by aSecond in aData, or aLength if there is none. Uses AVX2 or SSE2 when
+// the compiler targets them and falls back to memchr otherwise, as on the
+// Roku's ARM11, which has no NEON.
+size_t FindPair(const char* aData, size_t aLength, char aFirst, char aSecond);
+
+} // namespace scan
+
+#endif // #define SCAN_DOT_H
@@ -0,0 +1,133 @@
+#ifndef SCHEMA_DOT_H
+#define SCHEMA_DOT_H
+
+#include <stddef.h>
+#include <string.h>
+#include <string>
+
+// Compile time description of a JSON message. A schema lists the keys of a
+// message struct, the member each one fills, its type and whether it is
+// required. Matching a key is a switch on its length, and each case only
+// compares the first character and a fixed size memcmp of the keys that
+// have that length. Values are stored straight into the struct. Nothing
+// here needs exceptions or RTTI.
+namespace schema {
+
+// Longest key a schema may declare, the last case of the length switch.
+const size_t sMaxKeyLength = 16;
+
+// Declares a key type for use in fields.
+#define SCHEMA_KEY(Name, Text) \
+  struct Name { \
+    static const char* text() { return Text; } \
+    enum { length = sizeof(Text) - 1 }; \
+  }
+
+// Bit is the field's flag in the message's presence mask.
+template<class Key, class Message, unsigned int Bit, std::string Message::*Member, bool Required = true>
+struct String {
+  typedef Key KeyType;
+  enum { bit = Bit, required = Required };
+  static bool setString(Message& aMessage, const char* aValue, size_t aLength)
+  {
+    (aMessage.*Member).assign(aValue, aLength);
+    return true;
+  }
+  static bool setInteger(Message&, long long) { return false; }
+};
+
+template<class Key, class Message, unsigned int Bit, int Message::*Member, bool Required = true>
+struct Integer {
+  typedef Key KeyType;
+  enum { bit = Bit, required = Required };
+  static bool setString(Message&, const char*, size_t) { return false; }
+  static bool setInteger(Message& aMessage, long long aValue)
+  {
+    aMessage.*Member = (int)aValue;
+    return true;
+  }
+};
+
+template<class Message, class... Fields>
+struct Schema;
+
+template<class Message>
+struct Schema<Message> {
+  enum { all = 0, required = 0 };
+  template<size_t Length>
+  static unsigned int matchLength(const char*) { return 0; }
+  static bool setString(Message&, unsigned int, const char*, size_t) { return false; }
+  static bool setInteger(Message&, unsigned int, long long) { return false; }
+};
+
+template<class Message, class Field, class... Rest>
+struct Schema<Message, Field, Rest...> {
+  typedef Schema<Message, Rest...> Tail;
+  typedef typename Field::KeyType Key;
+
+  enum {
+    all = Field::bit | Tail::all,
+    required = (Field::required ? Field::bit : 0) | Tail::required
+  };
+
+  static_assert((Key::length > 0) && ((size_t)Key::length <= sMaxKeyLength),
+                "schema keys must be 1 to sMaxKeyLength characters");
+
+  // Returns the bit of the field named by aKey, or zero.
+  static unsigned int match(const char* aKey, size_t aLength)
+  {
+    switch (aLength) {
+#define SCHEMA_LENGTH_CASE(Length) \
+    case Length: return matchLength<Length>(aKey);
+    SCHEMA_LENGTH_CASE(1)  SCHEMA_LENGTH_CASE(2)  SCHEMA_LENGTH_CASE(3)
+    SCHEMA_LENGTH_CASE(4)  SCHEMA_LENGTH_CASE(5)  SCHEMA_LENGTH_CASE(6)
+    SCHEMA_LENGTH_CASE(7)  SCHEMA_LENGTH_CASE(8)  SCHEMA_LENGTH_CASE(9)
+    SCHEMA_LENGTH_CASE(10) SCHEMA_LENGTH_CASE(11) SCHEMA_LENGTH_CASE(12)
+    SCHEMA_LENGTH_CASE(13) SCHEMA_LENGTH_CASE(14) SCHEMA_LENGTH_CASE(15)
+    SCHEMA_LENGTH_CASE(16)
+#undef SCHEMA_LENGTH_CASE
+    default:
+      return 0;
+    }
+  }
+
+  // The fields whose keys are not Length long drop out at compile time, so
+  // a case of the switch above only holds the keys it can match.
+  template<size_t Length>
+  static unsigned int matchLength(const char* aKey)
+  {
+    if (((size_t)Key::length == Length) && (aKey[0] == Key::text()[0]) &&
+        (memcmp(aKey, Key::text(), Length) == 0)) {
+      return Field::bit;
+    }
+    return Tail::template matchLength<Length>(aKey);
+  }
+
+  // Store a value in the field with aBit. They return false when the value
+  // has the wrong type for it.
+  static bool setString(Message& aMessage, unsigned int aBit, const char* aValue, size_t aLength)
+  {
+    if (aBit == (unsigned int)Field::bit) {
+      return Field::setString(aMessage, aValue, aLength);
+    }
+    return Tail::setString(aMessage, aBit, aValue, aLength);
+  }
+
+  static bool setInteger(Message& aMessage, unsigned int aBit, long long aValue)
+  {
+    if (aBit == (unsigned int)Field::bit) {
+      return Field::setInteger(aMessage, aValue);
+    }
+    return Tail::setInteger(aMessage, aBit, aValue);
+  }
+
+  // True once every required field is in aFields.
+  static bool complete(unsigned int aFields)
+  {
+    return (aFields & (unsigned int)required) == (unsigned int)required;
+  }
+};
+
+} // namespace schema
+
+#endif // #define SCHEMA_DOT_H
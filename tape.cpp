@@ -0,0 +1,868 @@
+#include "tape.h"
+#include "json.h"
+
+extern "C" {
+#include "yajl_encode.h"
+#include "yajl_number.h"
+}
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define TAPE_X86 1
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define TAPE_NEON 1
+#endif
+
+namespace {
+
+// What the first pass needs to know about each byte of a block, one bit per
+// byte, lowest bit first.
+struct Block {
+  uint64_t quote;
+  uint64_t backslash;
+  // { } [ ] : and ,
+  uint64_t op;
+  uint64_t space;
+  // Below 0x20, never allowed in a string.
+  uint64_t control;
+  // 0x80 and above, the start of UTF-8 that needs validating.
+  uint64_t high;
+};
+
+typedef void (*Classify)(const unsigned char* aData, Block& aBlock);
+
+enum {
+  ClassQuote = 0x01,
+  ClassBackslash = 0x02,
+  ClassOp = 0x04,
+  ClassSpace = 0x08,
+  ClassControl = 0x10,
+  ClassHigh = 0x20
+};
+
+struct ClassTable {
+  unsigned char classes[256];
+
+  ClassTable()
+  {
+    for (int ix = 0; ix < 256; ix++) {
+      classes[ix] = (ix < 0x20 ? ClassControl : 0) | (ix >= 0x80 ? ClassHigh : 0);
+    }
+    classes[(unsigned char)'"'] |= ClassQuote;
+    classes[(unsigned char)'\\'] |= ClassBackslash;
+    const char* ops = "{}[]:,";
+    for (const char* op = ops; *op; op++) {
+      classes[(unsigned char)*op] |= ClassOp;
+    }
+    const char* spaces = " \t\n\r";
+    for (const char* space = spaces; *space; space++) {
+      classes[(unsigned char)*space] |= ClassSpace;
+    }
+  }
+};
+
+const ClassTable sClassTable;
+
+void
+ClassifyScalar(const unsigned char* aData, Block& aBlock)
+{
+  uint64_t quote = 0, backslash = 0, op = 0, space = 0, control = 0, high = 0;
+  for (unsigned int ix = 0; ix < 64; ix++) {
+    const unsigned int classes = sClassTable.classes[aData[ix]];
+    if (!classes) {
+      continue;
+    }
+    const uint64_t bit = 1ULL << ix;
+    quote |= (classes & ClassQuote) ? bit : 0;
+    backslash |= (classes & ClassBackslash) ? bit : 0;
+    op |= (classes & ClassOp) ? bit : 0;
+    space |= (classes & ClassSpace) ? bit : 0;
+    control |= (classes & ClassControl) ? bit : 0;
+    high |= (classes & ClassHigh) ? bit : 0;
+  }
+  aBlock.quote = quote;
+  aBlock.backslash = backslash;
+  aBlock.op = op;
+  aBlock.space = space;
+  aBlock.control = control;
+  aBlock.high = high;
+}
+
+#if defined(TAPE_X86)
+// Operators and whitespace are found with one table lookup on the low
+// nibble each. Setting bit 0x20 folds brackets onto braces, so a byte is an
+// operator when it then equals the table entry for its nibble. Bytes with
+// the high bit set look up zero and never match.
+#define TAPE_OP_TABLE 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, ':', '{', ',', '}', 0, 0
+#define TAPE_SPACE_TABLE ' ', 100, 100, 100, 17, 100, 113, 2, 100, '\t', '\n', 112, 100, '\r', 100, 100
+
+__attribute__((target("sse4.2")))
+void
+ClassifySSE42(const unsigned char* aData, Block& aBlock)
+{
+  const __m128i opTable = _mm_setr_epi8(TAPE_OP_TABLE);
+  const __m128i spaceTable = _mm_setr_epi8(TAPE_SPACE_TABLE);
+  const __m128i lower = _mm_set1_epi8(0x20);
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control = _mm_set1_epi8(0x1f);
+
+  Block block = { 0, 0, 0, 0, 0, 0 };
+  for (unsigned int ix = 0; ix < 64; ix += 16) {
+    const __m128i chunk = _mm_loadu_si128((const __m128i*)(aData + ix));
+    const __m128i op = _mm_cmpeq_epi8(_mm_shuffle_epi8(opTable, chunk), _mm_or_si128(chunk, lower));
+    const __m128i space = _mm_cmpeq_epi8(_mm_shuffle_epi8(spaceTable, chunk), chunk);
+    block.quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, quote)) << ix;
+    block.backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, backslash)) << ix;
+    block.op |= (uint64_t)(uint16_t)_mm_movemask_epi8(op) << ix;
+    block.space |= (uint64_t)(uint16_t)_mm_movemask_epi8(space) << ix;
+    block.control |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+      _mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control)) << ix;
+    block.high |= (uint64_t)(uint16_t)_mm_movemask_epi8(chunk) << ix;
+  }
+  aBlock = block;
+}
+
+__attribute__((target("avx2")))
+void
+ClassifyAVX2(const unsigned char* aData, Block& aBlock)
+{
+  const __m256i opTable = _mm256_setr_epi8(TAPE_OP_TABLE, TAPE_OP_TABLE);
+  const __m256i spaceTable = _mm256_setr_epi8(TAPE_SPACE_TABLE, TAPE_SPACE_TABLE);
+  const __m256i lower = _mm256_set1_epi8(0x20);
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i control = _mm256_set1_epi8(0x1f);
+
+  Block block = { 0, 0, 0, 0, 0, 0 };
+  for (unsigned int ix = 0; ix < 64; ix += 32) {
+    const __m256i chunk = _mm256_loadu_si256((const __m256i*)(aData + ix));
+    const __m256i op = _mm256_cmpeq_epi8(_mm256_shuffle_epi8(opTable, chunk), _mm256_or_si256(chunk, lower));
+    const __m256i space = _mm256_cmpeq_epi8(_mm256_shuffle_epi8(spaceTable, chunk), chunk);
+    block.quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, quote)) << ix;
+    block.backslash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, backslash)) << ix;
+    block.op |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << ix;
+    block.space |= (uint64_t)(uint32_t)_mm256_movemask_epi8(space) << ix;
+    block.control |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(_mm256_max_epu8(chunk, control), control)) << ix;
+    block.high |= (uint64_t)(uint32_t)_mm256_movemask_epi8(chunk) << ix;
+  }
+  aBlock = block;
+}
+
+#undef TAPE_OP_TABLE
+#undef TAPE_SPACE_TABLE
+#endif
+
+#if defined(TAPE_NEON)
+// NEON has no movemask. Weighting each lane by its bit and adding pairs
+// three times folds four compares into one 64 bit mask, on ARMv7 as well as
+// AArch64.
+uint64_t
+MoveMask(uint8x16_t aFirst, uint8x16_t aSecond, uint8x16_t aThird, uint8x16_t aFourth)
+{
+  static const uint8_t weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+  const uint8x16_t bits = vld1q_u8(weights);
+  const uint8x16_t first = vandq_u8(aFirst, bits);
+  const uint8x16_t second = vandq_u8(aSecond, bits);
+  const uint8x16_t third = vandq_u8(aThird, bits);
+  const uint8x16_t fourth = vandq_u8(aFourth, bits);
+  const uint8x8_t pairs01 = vpadd_u8(vpadd_u8(vget_low_u8(first), vget_high_u8(first)),
+                                     vpadd_u8(vget_low_u8(second), vget_high_u8(second)));
+  const uint8x8_t pairs23 = vpadd_u8(vpadd_u8(vget_low_u8(third), vget_high_u8(third)),
+                                     vpadd_u8(vget_low_u8(fourth), vget_high_u8(fourth)));
+  return vget_lane_u64(vreinterpret_u64_u8(vpadd_u8(pairs01, pairs23)), 0);
+}
+
+void
+ClassifyNEON(const unsigned char* aData, Block& aBlock)
+{
+  const uint8x16_t quote = vdupq_n_u8('"');
+  const uint8x16_t backslash = vdupq_n_u8('\\');
+  const uint8x16_t lower = vdupq_n_u8(0x20);
+  const uint8x16_t brace = vdupq_n_u8('{');
+  const uint8x16_t closeBrace = vdupq_n_u8('}');
+  const uint8x16_t colon = vdupq_n_u8(':');
+  const uint8x16_t comma = vdupq_n_u8(',');
+  const uint8x16_t space = vdupq_n_u8(' ');
+  const uint8x16_t tab = vdupq_n_u8('\t');
+  const uint8x16_t newline = vdupq_n_u8('\n');
+  const uint8x16_t ret = vdupq_n_u8('\r');
+  const uint8x16_t high = vdupq_n_u8(0x80);
+
+  uint8x16_t quotes[4], backslashes[4], ops[4], spaces[4], controls[4], highs[4];
+  for (unsigned int ix = 0; ix < 4; ix++) {
+    const uint8x16_t chunk = vld1q_u8(aData + (ix * 16));
+    const uint8x16_t folded = vorrq_u8(chunk, lower);
+    quotes[ix] = vceqq_u8(chunk, quote);
+    backslashes[ix] = vceqq_u8(chunk, backslash);
+    ops[ix] = vorrq_u8(vorrq_u8(vceqq_u8(folded, brace), vceqq_u8(folded, closeBrace)),
+                       vorrq_u8(vceqq_u8(chunk, colon), vceqq_u8(chunk, comma)));
+    spaces[ix] = vorrq_u8(vorrq_u8(vceqq_u8(chunk, space), vceqq_u8(chunk, tab)),
+                          vorrq_u8(vceqq_u8(chunk, newline), vceqq_u8(chunk, ret)));
+    controls[ix] = vcltq_u8(chunk, lower);
+    highs[ix] = vcgeq_u8(chunk, high);
+  }
+  aBlock.quote = MoveMask(quotes[0], quotes[1], quotes[2], quotes[3]);
+  aBlock.backslash = MoveMask(backslashes[0], backslashes[1], backslashes[2], backslashes[3]);
+  aBlock.op = MoveMask(ops[0], ops[1], ops[2], ops[3]);
+  aBlock.space = MoveMask(spaces[0], spaces[1], spaces[2], spaces[3]);
+  aBlock.control = MoveMask(controls[0], controls[1], controls[2], controls[3]);
+  aBlock.high = MoveMask(highs[0], highs[1], highs[2], highs[3]);
+}
+#endif
+
+// Picks the widest classifier the CPU runs. x86 is checked at runtime, ARM
+// by what the build targets since NEON is not optional there once enabled.
+struct Dispatch {
+  Classify classify;
+  const char* name;
+
+  Dispatch() : classify(ClassifyScalar), name("scalar")
+  {
+#if defined(TAPE_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      classify = ClassifyAVX2;
+      name = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse4.2")) {
+      classify = ClassifySSE42;
+      name = "sse4.2";
+    }
+#elif defined(TAPE_NEON)
+    classify = ClassifyNEON;
+    name = "neon";
+#endif
+  }
+};
+
+const Dispatch sDispatch;
+
+// Bits that end an odd length run of backslashes, so the character there is
+// escaped. aCarry holds whether the previous block ended in such a run.
+uint64_t
+FindEscaped(uint64_t aBackslash, uint64_t& aCarry)
+{
+  const uint64_t even = 0x5555555555555555ULL;
+  const uint64_t odd = ~even;
+  const uint64_t starts = aBackslash & ~(aBackslash << 1);
+  // A run carried over from the previous block starts at an odd position.
+  const uint64_t evenStartMask = even ^ aCarry;
+  const uint64_t evenStarts = starts & evenStartMask;
+  const uint64_t oddStarts = starts & ~evenStartMask;
+
+  const uint64_t evenCarries = aBackslash + evenStarts;
+  uint64_t oddCarries = aBackslash + oddStarts;
+  const bool overflow = oddCarries < aBackslash;
+  oddCarries |= aCarry;
+  aCarry = overflow ? 1 : 0;
+
+  const uint64_t evenCarryEnds = evenCarries & ~aBackslash;
+  const uint64_t oddCarryEnds = oddCarries & ~aBackslash;
+  return (evenCarryEnds & odd) | (oddCarryEnds & even);
+}
+
+// Bit i of the result is the parity of bits 0 through i.
+uint64_t
+PrefixXor(uint64_t aBits)
+{
+  aBits ^= aBits << 1;
+  aBits ^= aBits << 2;
+  aBits ^= aBits << 4;
+  aBits ^= aBits << 8;
+  aBits ^= aBits << 16;
+  aBits ^= aBits << 32;
+  return aBits;
+}
+
+inline uint64_t
+Word(char aType, uint64_t aPayload)
+{
+  return ((uint64_t)(unsigned char)aType << 56) | aPayload;
+}
+
+const uint64_t sPayloadMask = (1ULL << 56) - 1;
+const uint32_t sMaxCount = (1 << 24) - 1;
+
+inline bool
+IsTerminator(unsigned char aChar)
+{
+  return (sClassTable.classes[aChar] & (ClassOp | ClassSpace)) != 0;
+}
+
+inline bool
+IsDigit(unsigned char aChar)
+{
+  return (aChar >= '0') && (aChar <= '9');
+}
+
+inline bool
+IsHex(unsigned char aChar)
+{
+  return IsDigit(aChar) || ((aChar | 0x20) >= 'a' && (aChar | 0x20) <= 'f');
+}
+
+} // namespace
+
+namespace tape {
+
+// Objects with at least this many keys get a hash index on their first
+// lookup. Below it a linear scan is as fast.
+static const size_t sIndexThreshold = 12;
+
+const char*
+Implementation()
+{
+  return sDispatch.name;
+}
+
+Parser::Parser() :
+  mIndexCount(0),
+  mStringBase(NULL),
+  mStringsUsed(0),
+  mHighBytes(false) {}
+
+bool
+Parser::parse(const char* aData, size_t aLength)
+{
+  // Unescaped strings and their NULs never outgrow the text they came from.
+  if (mStrings.size() < (aLength + 1)) {
+    mStrings.resize(aLength + 1);
+  }
+  return run(aData, aLength, &mStrings[0]);
+}
+
+bool
+Parser::parseInPlace(char* aData, size_t aLength)
+{
+  return run(aData, aLength, NULL);
+}
+
+bool
+Parser::run(const char* aData, size_t aLength, char* aStrings)
+{
+  mTape.clear();
+  mKeyIndexes.clear();
+  mSlots.clear();
+  mError.clear();
+  if (aLength >= 0xffffffc0) {
+    return fail("document too large", 0);
+  }
+  return index((const unsigned char*)aData, aLength) && build(aData, aLength, aStrings);
+}
+
+bool
+Parser::fail(const char* aMessage, size_t aOffset)
+{
+  char offset[32];
+  snprintf(offset, sizeof(offset), "%lu", (unsigned long)aOffset);
+  mError = "parse error: ";
+  mError += aMessage;
+  mError += " at offset ";
+  mError += offset;
+  mTape.clear();
+  return false;
+}
+
+// First pass. Records the offset of every structural character, both quotes
+// of every string and the first byte of every other scalar.
+bool
+Parser::index(const unsigned char* aData, size_t aLength)
+{
+  if (mIndex.size() < (aLength + 1)) {
+    mIndex.resize(aLength + 1);
+  }
+  uint32_t* out = &mIndex[0];
+  const Classify classify = sDispatch.classify;
+
+  uint64_t escapeCarry = 0;
+  uint64_t inStringCarry = 0;
+  uint64_t scalarCarry = 0;
+  uint64_t high = 0;
+  unsigned char tail[64];
+  for (size_t offset = 0; offset < aLength; offset += 64) {
+    const unsigned char* data = aData + offset;
+    // Pad the last block with spaces, which add nothing to the index.
+    if ((aLength - offset) < 64) {
+      memset(tail, ' ', sizeof(tail));
+      memcpy(tail, data, aLength - offset);
+      data = tail;
+    }
+    Block block;
+    classify(data, block);
+
+    const uint64_t quote = block.quote & ~FindEscaped(block.backslash, escapeCarry);
+    const uint64_t inString = PrefixXor(quote) ^ inStringCarry;
+    inStringCarry = (uint64_t)((int64_t)inString >> 63);
+    if (block.control & inString) {
+      return fail("invalid character inside string", offset + __builtin_ctzll(block.control & inString));
+    }
+    high |= block.high;
+
+    // A scalar starts wherever a byte that is not structural or space does
+    // not follow another one. Closing quotes count as well so the second
+    // pass gets the extent of each string for free.
+    const uint64_t scalar = ~(block.op | block.space);
+    const uint64_t bare = scalar & ~quote;
+    const uint64_t follows = (bare << 1) | scalarCarry;
+    scalarCarry = bare >> 63;
+    const uint64_t stringTail = inString ^ quote;
+    uint64_t structural = ((block.op | (scalar & ~follows)) & ~stringTail) | (quote & ~inString);
+
+    while (structural) {
+      *out++ = (uint32_t)(offset + __builtin_ctzll(structural));
+      structural &= structural - 1;
+    }
+  }
+  if (inStringCarry) {
+    return fail("unterminated string", aLength);
+  }
+  mIndexCount = out - &mIndex[0];
+  mHighBytes = (high != 0);
+  return true;
+}
+
+// Second pass. Checks the grammar over the index and writes the tape.
+bool
+Parser::build(const char* aData, size_t aLength, char* aStrings)
+{
+  enum Expect {
+    ExpectValue,
+    ExpectFirstElement,
+    ExpectFirstKey,
+    ExpectKey,
+    ExpectColon,
+    ExpectNext
+  };
+
+  const uint32_t* index = &mIndex[0];
+  const size_t count = mIndexCount;
+  mStringBase = (aStrings ? aStrings : aData);
+  mStringsUsed = 0;
+  mStack.clear();
+  mTape.push_back(Word('r', 0));
+
+  Expect expect = ExpectValue;
+  size_t ix = 0;
+  while (ix < count) {
+    const uint32_t offset = index[ix++];
+    const unsigned char c = aData[offset];
+    switch (expect) {
+    case ExpectFirstElement:
+      if (c == ']') {
+        break;
+      }
+      // Fall through
+    case ExpectValue:
+      if ((c == '{') || (c == '[')) {
+        Frame frame = { (uint32_t)mTape.size(), 0 };
+        mStack.push_back(frame);
+        mTape.push_back(Word(c, 0));
+        expect = (c == '{' ? ExpectFirstKey : ExpectFirstElement);
+        continue;
+      }
+      if (c == '"') {
+        if ((ix == count) || !addString(aData, offset, index[ix++], aStrings)) {
+          return false;
+        }
+      }
+      else if (!addScalar(aData, aLength, offset)) {
+        return false;
+      }
+      if (!mStack.empty()) {
+        mStack.back().count++;
+      }
+      expect = ExpectNext;
+      continue;
+    case ExpectFirstKey:
+      if (c == '}') {
+        break;
+      }
+      // Fall through
+    case ExpectKey:
+      if ((c != '"') || (ix == count)) {
+        return fail("invalid object key", offset);
+      }
+      if (!addString(aData, offset, index[ix++], aStrings)) {
+        return false;
+      }
+      expect = ExpectColon;
+      continue;
+    case ExpectColon:
+      if (c != ':') {
+        return fail("object key and value must be separated by a colon", offset);
+      }
+      expect = ExpectValue;
+      continue;
+    case ExpectNext:
+      if (mStack.empty()) {
+        return fail("trailing garbage", offset);
+      }
+      if (c == ',') {
+        expect = (mTape[mStack.back().open] >> 56) == '{' ? ExpectKey : ExpectValue;
+        continue;
+      }
+      if (c != ((mTape[mStack.back().open] >> 56) == '{' ? '}' : ']')) {
+        return fail("expected comma or close", offset);
+      }
+      break;
+    }
+
+    // Only closing an object or array gets here.
+    const Frame frame = mStack.back();
+    mStack.pop_back();
+    const uint32_t members = (frame.count > sMaxCount ? sMaxCount : frame.count);
+    mTape.push_back(Word(c, frame.open));
+    mTape[frame.open] |= ((uint64_t)members << 32) | (uint64_t)mTape.size();
+    if (!mStack.empty()) {
+      mStack.back().count++;
+    }
+    expect = ExpectNext;
+  }
+
+  if ((expect != ExpectNext) || !mStack.empty()) {
+    return fail("premature EOF", aLength);
+  }
+  mTape[0] |= (uint64_t)mTape.size();
+  return true;
+}
+
+bool
+Parser::addString(const char* aData, uint32_t aOpen, uint32_t aClose, char* aStrings)
+{
+  const unsigned char* start = (const unsigned char*)aData + aOpen + 1;
+  const size_t length = aClose - aOpen - 1;
+  if (aData[aClose] != '"') {
+    return fail("invalid string", aClose);
+  }
+
+  // The first pass has already matched the quotes, so what is left to check
+  // is each escape and, when the document has any, the UTF-8. UTF-8 goes
+  // first since unescaping in place overwrites the text.
+  const unsigned char* end = start + length;
+  if (mHighBytes && !yajl_string_validate_utf8(start, length)) {
+    return fail("invalid UTF-8 in string", aOpen);
+  }
+
+  // Escapes are checked and unescaped in the same pass. A \u hands the rest
+  // of the string to yajl_string_unescape so surrogates decode exactly as
+  // they do with yajl.
+  unsigned char* out = (unsigned char*)(aStrings ? aStrings + mStringsUsed : (char*)start);
+  unsigned char* const first = out;
+  const unsigned char* at = start;
+  while (at < end) {
+    const unsigned char* escape = (const unsigned char*)memchr(at, '\\', end - at);
+    const size_t run = (escape ? escape : end) - at;
+    if (out != at) {
+      memmove(out, at, run);
+    }
+    out += run;
+    if (!escape) {
+      break;
+    }
+    switch (escape[1]) {
+    case '"': *out++ = '"'; break;
+    case '\\': *out++ = '\\'; break;
+    case '/': *out++ = '/'; break;
+    case 'b': *out++ = '\b'; break;
+    case 'f': *out++ = '\f'; break;
+    case 'n': *out++ = '\n'; break;
+    case 'r': *out++ = '\r'; break;
+    case 't': *out++ = '\t'; break;
+    case 'u':
+      for (const unsigned char* check = escape;
+           (check = (const unsigned char*)memchr(check, '\\', end - check)); check += 2) {
+        if (check[1] == 'u') {
+          if (((end - check) < 6) || !IsHex(check[2]) || !IsHex(check[3]) || !IsHex(check[4]) || !IsHex(check[5])) {
+            return fail("invalid \\u escape in string", check - (const unsigned char*)aData);
+          }
+          check += 4;
+        }
+        else if (!check[1] || !strchr("\"\\/bfnrt", check[1])) {
+          return fail("invalid escape in string", check - (const unsigned char*)aData);
+        }
+      }
+      out += yajl_string_unescape(out, escape, end - escape);
+      at = end;
+      continue;
+    default:
+      return fail("invalid escape in string", escape - (const unsigned char*)aData);
+    }
+    at = escape + 2;
+  }
+
+  *out = '\0';
+  const size_t decoded = out - first;
+  if (aStrings) {
+    mStringsUsed += decoded + 1;
+  }
+  mTape.push_back(Word('"', (uint64_t)((char*)first - mStringBase)));
+  mTape.push_back((uint64_t)decoded);
+  return true;
+}
+
+bool
+Parser::addScalar(const char* aData, size_t aLength, uint32_t aStart)
+{
+  const unsigned char* data = (const unsigned char*)aData;
+  const unsigned char c = data[aStart];
+  size_t at = aStart;
+
+  if ((c == 't') || (c == 'f') || (c == 'n')) {
+    const char* literal = (c == 't' ? "true" : (c == 'f' ? "false" : "null"));
+    const size_t size = strlen(literal);
+    if (((aLength - aStart) < size) || (memcmp(data + aStart, literal, size) != 0) ||
+        (((aStart + size) < aLength) && !IsTerminator(data[aStart + size]))) {
+      return fail("invalid literal", aStart);
+    }
+    mTape.push_back(Word(c, 0));
+    return true;
+  }
+
+  // Same grammar as yajl: an optional minus, no leading zeros, then an
+  // optional fraction and exponent that each need at least one digit.
+  bool integer = true;
+  if ((at < aLength) && (data[at] == '-')) {
+    at++;
+  }
+  if ((at == aLength) || !IsDigit(data[at])) {
+    return fail((c == '-' ? "malformed number" : "invalid character"), aStart);
+  }
+  if (data[at] == '0') {
+    at++;
+  }
+  else {
+    while ((at < aLength) && IsDigit(data[at])) {
+      at++;
+    }
+  }
+  if ((at < aLength) && (data[at] == '.')) {
+    integer = false;
+    at++;
+    if ((at == aLength) || !IsDigit(data[at])) {
+      return fail("malformed number", aStart);
+    }
+    while ((at < aLength) && IsDigit(data[at])) {
+      at++;
+    }
+  }
+  if ((at < aLength) && ((data[at] | 0x20) == 'e')) {
+    integer = false;
+    at++;
+    if ((at < aLength) && ((data[at] == '+') || (data[at] == '-'))) {
+      at++;
+    }
+    if ((at == aLength) || !IsDigit(data[at])) {
+      return fail("malformed number", aStart);
+    }
+    while ((at < aLength) && IsDigit(data[at])) {
+      at++;
+    }
+  }
+  if ((at < aLength) && !IsTerminator(data[at])) {
+    return fail("invalid character after number", at);
+  }
+
+  // Integers that overflow a long long fall back to double, as yajl_tree
+  // leaves them without YAJL_NUMBER_INT_VALID.
+  if (integer) {
+    const bool negative = (c == '-');
+    uint64_t value = 0;
+    size_t digit = aStart + (negative ? 1 : 0);
+    const uint64_t limit = (uint64_t)9223372036854775807LL + (negative ? 1 : 0);
+    for (; digit < at; digit++) {
+      const unsigned int next = data[digit] - '0';
+      if ((value > (limit / 10)) || ((limit - (value * 10)) < next)) {
+        break;
+      }
+      value = (value * 10) + next;
+    }
+    if (digit == at) {
+      const long long result = ((negative && value) ? -(long long)(value - 1) - 1 : (long long)value);
+      mTape.push_back(Word('l', 0));
+      mTape.push_back((uint64_t)result);
+      return true;
+    }
+  }
+
+  double value = 0;
+  const size_t size = at - aStart;
+  if (!yajl_parse_double((const unsigned char*)aData + aStart, size, &value)) {
+    // Copied out since the text need not be NUL terminated right after it.
+    char stack[64];
+    std::string heap;
+    char* text = stack;
+    if (size >= sizeof(stack)) {
+      heap.assign(aData + aStart, size);
+      text = &heap[0];
+    }
+    else {
+      memcpy(stack, aData + aStart, size);
+      stack[size] = '\0';
+    }
+    value = strtod(text, NULL);
+  }
+  uint64_t bits = 0;
+  memcpy(&bits, &value, sizeof(bits));
+  mTape.push_back(Word('d', 0));
+  mTape.push_back(bits);
+  return true;
+}
+
+char
+Parser::type(size_t aValue) const
+{
+  if (!aValue || (aValue >= mTape.size())) {
+    return 0;
+  }
+  return (char)(mTape[aValue] >> 56);
+}
+
+// Position of the value after aValue.
+size_t
+Parser::skip(size_t aValue) const
+{
+  switch (type(aValue)) {
+  case '{':
+  case '[':
+    return (size_t)(mTape[aValue] & 0xffffffff);
+  case '"':
+  case 'l':
+  case 'd':
+    return aValue + 2;
+  default:
+    return aValue + 1;
+  }
+}
+
+size_t
+Parser::length(size_t aValue) const
+{
+  const char kind = type(aValue);
+  if ((kind != '{') && (kind != '[')) {
+    return 0;
+  }
+  const size_t count = (size_t)((mTape[aValue] >> 32) & sMaxCount);
+  if (count < sMaxCount) {
+    return count;
+  }
+  // Saturated, so count the hard way.
+  size_t total = 0;
+  const size_t end = skip(aValue) - 1;
+  for (size_t at = aValue + 1; at < end; at = skip(at + (kind == '{' ? 2 : 0))) {
+    total++;
+  }
+  return total;
+}
+
+size_t
+Parser::element(size_t aArray, size_t aIndex) const
+{
+  if (!isArray(aArray) || (aIndex >= length(aArray))) {
+    return 0;
+  }
+  size_t at = aArray + 1;
+  while (aIndex--) {
+    at = skip(at);
+  }
+  return at;
+}
+
+// Returns the index of a large object, building it on first use. Slots of
+// every index share mSlots.
+const Parser::KeyIndex*
+Parser::keyIndex(size_t aObject)
+{
+  const size_t count = mKeyIndexes.size();
+  for (size_t ix = 0; ix < count; ix++) {
+    if (mKeyIndexes[ix].object == aObject) {
+      return &mKeyIndexes[ix];
+    }
+  }
+
+  mMembers.clear();
+  const size_t end = skip(aObject) - 1;
+  for (size_t at = aObject + 1; at < end; at = skip(at + 2)) {
+    mMembers.push_back((uint32_t)at);
+  }
+  size_t size = 16;
+  while (size < (mMembers.size() * 2)) {
+    size *= 2;
+  }
+  KeyIndex index = { (uint32_t)aObject, (uint32_t)(size - 1), mSlots.size() };
+  const Slot empty = { 0, 0 };
+  mSlots.resize(mSlots.size() + size, empty);
+  Slot* slots = &mSlots[index.first];
+  // Probing reaches keys in the order they went in, so inserting in member
+  // order finds the first of any duplicate keys, as a linear scan does.
+  for (size_t member = 0; member < mMembers.size(); member++) {
+    const size_t key = mMembers[member];
+    const uint32_t hash = JSONKey::Hash(mStringBase + (mTape[key] & sPayloadMask), (size_t)mTape[key + 1]);
+    size_t slot = hash & index.mask;
+    while (slots[slot].key) {
+      slot = (slot + 1) & index.mask;
+    }
+    slots[slot].hash = hash;
+    slots[slot].key = (uint32_t)key;
+  }
+  mKeyIndexes.push_back(index);
+  return &mKeyIndexes.back();
+}
+
+size_t
+Parser::lookup(size_t aObject, const char* aKey, size_t aLength, uint32_t aHash)
+{
+  if (!isObject(aObject)) {
+    return 0;
+  }
+  if (length(aObject) < sIndexThreshold) {
+    const size_t end = skip(aObject) - 1;
+    for (size_t at = aObject + 1; at < end; at = skip(at + 2)) {
+      if (((size_t)mTape[at + 1] == aLength) &&
+          (memcmp(mStringBase + (mTape[at] & sPayloadMask), aKey, aLength) == 0)) {
+        return at + 2;
+      }
+    }
+    return 0;
+  }
+
+  const KeyIndex* index = keyIndex(aObject);
+  const Slot* slots = &mSlots[index->first];
+  for (size_t slot = aHash & index->mask; slots[slot].key; slot = (slot + 1) & index->mask) {
+    const size_t at = slots[slot].key;
+    if ((slots[slot].hash == aHash) && ((size_t)mTape[at + 1] == aLength) &&
+        (memcmp(mStringBase + (mTape[at] & sPayloadMask), aKey, aLength) == 0)) {
+      return at + 2;
+    }
+  }
+  return 0;
+}
+
+bool
+Parser::string(size_t aValue, const char*& aData, size_t& aLength) const
+{
+  if (type(aValue) != '"') {
+    return false;
+  }
+  aData = mStringBase + (mTape[aValue] & sPayloadMask);
+  aLength = (size_t)mTape[aValue + 1];
+  return true;
+}
+
+bool
+Parser::integer(size_t aValue, long long& aResult) const
+{
+  if (type(aValue) != 'l') {
+    return false;
+  }
+  aResult = (long long)mTape[aValue + 1];
+  return true;
+}
+
+} // namespace tape
@@ -0,0 +1,90 @@
+#ifndef TAPE_DOT_H
+#define TAPE_DOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// JSON parser in two passes, after simdjson. The first classifies the text
+// 64 bytes at a time with SIMD and records the offset of every structural
+// character, string quote and scalar in an index. The second walks the
+// index, checking the grammar, and writes a tape of 64 bit words: one per
+// value, two for strings and numbers. Containers hold the position just
+// past their end, so a whole value is skipped in one step.
+namespace tape {
+
+// Instruction set the first pass picked at startup: "avx2", "sse4.2",
+// "neon" or "scalar".
+const char* Implementation();
+
+class Parser {
+public:
+  Parser();
+
+  // Parses aLength bytes of aData, copying strings out of it. Reusing a
+  // parser keeps its buffers, so steady state parsing does not allocate.
+  bool parse(const char* aData, size_t aLength);
+  // Like parse(), but unescapes strings inside aData, which string() then
+  // points into.
+  bool parseInPlace(char* aData, size_t aLength);
+  const std::string& error() const { return mError; }
+
+  // Values are tape positions, zero meaning none.
+  size_t root() const { return mTape.size() > 1 ? 1 : 0; }
+  bool isObject(size_t aValue) const { return type(aValue) == '{'; }
+  bool isArray(size_t aValue) const { return type(aValue) == '['; }
+  // Members of an object or elements of an array.
+  size_t length(size_t aValue) const;
+  size_t element(size_t aArray, size_t aIndex) const;
+  // The value of the first member named aKey, aHash being its JSONKey::Hash.
+  size_t lookup(size_t aObject, const char* aKey, size_t aLength, uint32_t aHash);
+  // NUL terminated, valid until the next parse.
+  bool string(size_t aValue, const char*& aData, size_t& aLength) const;
+  // Fails for numbers that are not integers or do not fit.
+  bool integer(size_t aValue, long long& aResult) const;
+
+protected:
+  struct Frame {
+    uint32_t open;
+    uint32_t count;
+  };
+  struct Slot {
+    uint32_t hash;
+    // Tape position of the key, zero when empty.
+    uint32_t key;
+  };
+  struct KeyIndex {
+    uint32_t object;
+    uint32_t mask;
+    size_t first;
+  };
+
+  char type(size_t aValue) const;
+  size_t skip(size_t aValue) const;
+  const KeyIndex* keyIndex(size_t aObject);
+
+  bool run(const char* aData, size_t aLength, char* aStrings);
+  bool index(const unsigned char* aData, size_t aLength);
+  bool build(const char* aData, size_t aLength, char* aStrings);
+  bool addString(const char* aData, uint32_t aOpen, uint32_t aClose, char* aStrings);
+  bool addScalar(const char* aData, size_t aLength, uint32_t aStart);
+  bool fail(const char* aMessage, size_t aOffset);
+
+  std::vector<uint32_t> mIndex;
+  size_t mIndexCount;
+  std::vector<uint64_t> mTape;
+  std::vector<Frame> mStack;
+  std::vector<char> mStrings;
+  const char* mStringBase;
+  size_t mStringsUsed;
+  bool mHighBytes;
+  std::vector<KeyIndex> mKeyIndexes;
+  std::vector<Slot> mSlots;
+  std::vector<uint32_t> mMembers;
+  std::string mError;
+};
+
+} // namespace tape
+
+#endif // #define TAPE_DOT_H
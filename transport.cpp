@@ -0,0 +1,424 @@
+#include "transport.h"
+
+#include <stdio.h>
+#include <vector>
+
+#include "mozilla/RefPtr.h"
+#include "MediaMutex.h"
+#include "MediaSocketTransportService.h"
+
+#if defined(__linux__)
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "prthread.h"
+#include "private/pprio.h"
+#endif
+
+#define TLOG(format, ...) fprintf(stderr, format, ##__VA_ARGS__);
+
+typedef media::MutexAutoLock MutexAutoLock;
+
+namespace transport {
+
+// An attached socket. Only touched on the transport thread.
+struct Entry {
+  PRFileDesc* mSocket;
+  mozilla::RefPtr<SignalHandler> mHandler;
+  // Position in mEntries, so detaching does not search for it.
+  size_t mIndex;
+  // Already on the list of entries to look at again, or to detach.
+  bool mPoked;
+  bool mDead;
+};
+
+} // namespace transport
+
+using transport::Entry;
+
+namespace {
+
+class DispatchSocketHandler : public media::Runnable {
+public:
+  DispatchSocketHandler(PRFileDesc* aSocket, SignalHandler* aHandler) :
+    mSocket(aSocket),
+    mHandler(aHandler) {}
+  virtual nsresult Run(void)
+  {
+    mozilla::RefPtr<media::SocketTransportService> sts = media::GetSocketTransportService();
+    sts->AttachSocket(mSocket, mHandler);
+    return NS_OK;
+  }
+protected:
+  PRFileDesc* mSocket;
+  mozilla::RefPtr<SignalHandler> mHandler;
+};
+
+#if defined(__linux__)
+
+class EpollTransport {
+public:
+  EpollTransport();
+  ~EpollTransport();
+
+  bool Start();
+  void Stop();
+  void Attach(PRFileDesc* aSocket, SignalHandler* aHandler);
+  void Dispatch(media::Runnable* aRunnable);
+  // Has the transport thread look at aEntry again before it next waits.
+  void Poke(Entry* aEntry);
+
+protected:
+  static void ThreadFunc(void* aSelf);
+  void Run();
+  void Wake();
+  void Ready(Entry* aEntry, int16_t aFlags);
+  void Kill(Entry* aEntry);
+  void Detach(Entry* aEntry);
+
+  int mEpoll;
+  int mWake;
+  PRThread* mThread;
+
+  media::Mutex mMutex;
+  std::vector<Entry*> mAttaching;
+  std::vector<mozilla::RefPtr<media::Runnable> > mRunnables;
+  bool mStopping;
+
+  // Only touched on the transport thread. Handlers that asked for write
+  // polling or closed since the last wakeup are poked, and those whose
+  // condition failed are dead until the end of the pass.
+  std::vector<Entry*> mEntries;
+  std::vector<Entry*> mPoked;
+  std::vector<Entry*> mDead;
+};
+
+EpollTransport::EpollTransport() :
+  mEpoll(-1),
+  mWake(-1),
+  mThread(nullptr),
+  mMutex("EpollTransport.mMutex"),
+  mStopping(false) {}
+
+EpollTransport::~EpollTransport()
+{
+  if (mWake >= 0) { close(mWake); }
+  if (mEpoll >= 0) { close(mEpoll); }
+}
+
+bool
+EpollTransport::Start()
+{
+  mEpoll = epoll_create(16);
+  mWake = eventfd(0, EFD_NONBLOCK);
+  if ((mEpoll < 0) || (mWake < 0)) {
+    TLOG("ERROR: Failed to create epoll transport: %d\n", errno);
+    return false;
+  }
+
+  // The wakeup eventfd is the only entry without a handler.
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = nullptr;
+  if (epoll_ctl(mEpoll, EPOLL_CTL_ADD, mWake, &event) < 0) {
+    TLOG("ERROR: Failed to watch epoll wakeup: %d\n", errno);
+    return false;
+  }
+
+  mThread = PR_CreateThread(PR_USER_THREAD, ThreadFunc, this, PR_PRIORITY_NORMAL, PR_GLOBAL_THREAD, PR_JOINABLE_THREAD, 0);
+  return mThread != nullptr;
+}
+
+void
+EpollTransport::Stop()
+{
+  {
+    MutexAutoLock lock(mMutex);
+    mStopping = true;
+  }
+  Wake();
+  if (mThread) {
+    PR_JoinThread(mThread);
+    mThread = nullptr;
+  }
+
+  // Sockets attached after the thread last looked never got watched.
+  std::vector<Entry*> attaching;
+  {
+    MutexAutoLock lock(mMutex);
+    attaching.swap(mAttaching);
+  }
+  for (size_t ix = 0; ix < attaching.size(); ix++) {
+    attaching[ix]->mHandler->OnSocketDetached(attaching[ix]->mSocket);
+    delete attaching[ix];
+  }
+}
+
+void
+EpollTransport::Attach(PRFileDesc* aSocket, SignalHandler* aHandler)
+{
+  Entry* entry = new Entry;
+  entry->mSocket = aSocket;
+  entry->mHandler = aHandler;
+  entry->mIndex = 0;
+  entry->mPoked = false;
+  entry->mDead = false;
+  {
+    MutexAutoLock lock(mMutex);
+    mAttaching.push_back(entry);
+  }
+  Wake();
+}
+
+void
+EpollTransport::Dispatch(media::Runnable* aRunnable)
+{
+  {
+    MutexAutoLock lock(mMutex);
+    mRunnables.push_back(aRunnable);
+  }
+  Wake();
+}
+
+void
+EpollTransport::Wake()
+{
+  uint64_t one = 1;
+  if (write(mWake, &one, sizeof(one)) < 0) {
+    // Already signaled and not yet drained, which is just as good.
+  }
+}
+
+void
+EpollTransport::ThreadFunc(void* aSelf)
+{
+  PR_SetCurrentThreadName("Signaling Epoll");
+  static_cast<EpollTransport*>(aSelf)->Run();
+}
+
+void
+EpollTransport::Poke(Entry* aEntry)
+{
+  if (!aEntry->mPoked) {
+    aEntry->mPoked = true;
+    mPoked.push_back(aEntry);
+  }
+}
+
+void
+EpollTransport::Ready(Entry* aEntry, int16_t aFlags)
+{
+  aFlags &= (aEntry->mHandler->pollFlags() | PR_POLL_EXCEPT | PR_POLL_ERR | PR_POLL_NVAL | PR_POLL_HUP);
+  if (aFlags && NS_SUCCEEDED(aEntry->mHandler->condition())) {
+    aEntry->mHandler->OnSocketReady(aEntry->mSocket, aFlags);
+  }
+  if (NS_FAILED(aEntry->mHandler->condition())) {
+    Kill(aEntry);
+  }
+}
+
+void
+EpollTransport::Kill(Entry* aEntry)
+{
+  if (!aEntry->mDead) {
+    aEntry->mDead = true;
+    mDead.push_back(aEntry);
+  }
+}
+
+void
+EpollTransport::Detach(Entry* aEntry)
+{
+  // Fill the hole with the last entry instead of shifting the rest down.
+  Entry* last = mEntries.back();
+  mEntries[aEntry->mIndex] = last;
+  last->mIndex = aEntry->mIndex;
+  mEntries.pop_back();
+
+  epoll_ctl(mEpoll, EPOLL_CTL_DEL, PR_FileDesc2NativeHandle(aEntry->mSocket), nullptr);
+  aEntry->mHandler->mEntry = nullptr;
+  aEntry->mHandler->OnSocketDetached(aEntry->mSocket);
+  delete aEntry;
+}
+
+void
+EpollTransport::Run()
+{
+  static const int sMaxEvents = 32;
+  struct epoll_event events[sMaxEvents];
+  std::vector<Entry*> attaching;
+  std::vector<mozilla::RefPtr<media::Runnable> > runnables;
+  bool stopping = false;
+
+  while (!stopping) {
+    int count = epoll_wait(mEpoll, events, sMaxEvents, -1);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      TLOG("ERROR: epoll_wait failed: %d\n", errno);
+      break;
+    }
+
+    bool woken = false;
+    for (int ix = 0; ix < count; ix++) {
+      Entry* entry = static_cast<Entry*>(events[ix].data.ptr);
+      if (!entry) {
+        uint64_t value;
+        if (read(mWake, &value, sizeof(value)) < 0) {
+          // Nothing pending, another wakeup already drained it.
+        }
+        woken = true;
+        continue;
+      }
+      int16_t flags = 0;
+      if (events[ix].events & EPOLLIN) { flags |= PR_POLL_READ; }
+      if (events[ix].events & EPOLLOUT) { flags |= PR_POLL_WRITE; }
+      if (events[ix].events & EPOLLPRI) { flags |= PR_POLL_EXCEPT; }
+      if (events[ix].events & EPOLLERR) { flags |= PR_POLL_ERR; }
+      // Let the handler read the end of stream.
+      if (events[ix].events & (EPOLLHUP | EPOLLRDHUP)) { flags |= PR_POLL_HUP | PR_POLL_READ; }
+      Ready(entry, flags);
+    }
+
+    if (woken) {
+      {
+        MutexAutoLock lock(mMutex);
+        attaching.swap(mAttaching);
+        runnables.swap(mRunnables);
+        stopping = mStopping;
+      }
+      for (size_t ix = 0; ix < attaching.size(); ix++) {
+        Entry* entry = attaching[ix];
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = entry;
+        if (epoll_ctl(mEpoll, EPOLL_CTL_ADD, PR_FileDesc2NativeHandle(entry->mSocket), &event) < 0) {
+          TLOG("ERROR: Failed to watch signaling socket: %d\n", errno);
+          entry->mHandler->OnSocketDetached(entry->mSocket);
+          delete entry;
+          continue;
+        }
+        entry->mIndex = mEntries.size();
+        entry->mHandler->mEntry = entry;
+        mEntries.push_back(entry);
+      }
+      attaching.clear();
+      for (size_t ix = 0; ix < runnables.size(); ix++) {
+        runnables[ix]->Run();
+      }
+      runnables.clear();
+    }
+
+    // A runnable may have asked for write polling after the socket last
+    // became writable, and that edge will not be reported again. Handlers
+    // may also have been closed from outside OnSocketReady.
+    for (size_t ix = 0; ix < mPoked.size(); ix++) {
+      Entry* entry = mPoked[ix];
+      entry->mPoked = false;
+      Ready(entry, PR_POLL_WRITE);
+    }
+    mPoked.clear();
+
+    if (stopping) {
+      while (!mEntries.empty()) {
+        Detach(mEntries.back());
+      }
+      mDead.clear();
+      break;
+    }
+    for (size_t ix = 0; ix < mDead.size(); ix++) {
+      Detach(mDead[ix]);
+    }
+    mDead.clear();
+  }
+}
+
+EpollTransport* sEpoll = nullptr;
+
+#endif // defined(__linux__)
+
+} // namespace
+
+void
+SignalHandler::watchForWrite()
+{
+  mPollFlags |= PR_POLL_WRITE;
+#if defined(__linux__)
+  if (sEpoll && mEntry) {
+    sEpoll->Poke(mEntry);
+  }
+#endif
+}
+
+void
+SignalHandler::close(nsresult aCondition)
+{
+  mCondition = aCondition;
+#if defined(__linux__)
+  if (sEpoll && mEntry) {
+    sEpoll->Poke(mEntry);
+  }
+#endif
+}
+
+namespace transport {
+
+bool
+UseEpoll()
+{
+#if defined(__linux__)
+  if (!sEpoll) {
+    sEpoll = new EpollTransport;
+    if (!sEpoll->Start()) {
+      delete sEpoll;
+      sEpoll = nullptr;
+    }
+  }
+  return sEpoll != nullptr;
+#else
+  return false;
+#endif
+}
+
+void
+Shutdown()
+{
+#if defined(__linux__)
+  if (sEpoll) {
+    sEpoll->Stop();
+    delete sEpoll;
+    sEpoll = nullptr;
+  }
+#endif
+}
+
+void
+Attach(PRFileDesc* aSocket, SignalHandler* aHandler)
+{
+#if defined(__linux__)
+  if (sEpoll) {
+    sEpoll->Attach(aSocket, aHandler);
+    return;
+  }
+#endif
+  mozilla::RefPtr<DispatchSocketHandler> dispatch = new DispatchSocketHandler(aSocket, aHandler);
+  Dispatch(dispatch);
+}
+
+void
+Dispatch(media::Runnable* aRunnable)
+{
+#if defined(__linux__)
+  if (sEpoll) {
+    sEpoll->Dispatch(aRunnable);
+    return;
+  }
+#endif
+  mozilla::RefPtr<media::EventTarget> sts = media::GetSocketTransportServiceTarget();
+  sts->Dispatch(aRunnable, MEDIA_DISPATCH_NORMAL);
+}
+
+} // namespace transport
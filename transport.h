@@ -0,0 +1,53 @@
+#ifndef TRANSPORT_DOT_H
+#define TRANSPORT_DOT_H
+
+#include <stdint.h>
+
+#include "MediaASocketHandler.h"
+#include "MediaRunnable.h"
+
+#include "prio.h"
+
+namespace transport {
+struct Entry;
+}
+
+// Base for the signaling socket handlers. The epoll backend needs to see
+// the poll state the socket transport service reads directly.
+class SignalHandler : public media::ASocketHandler {
+public:
+  SignalHandler() : mEntry(nullptr) {}
+
+  uint16_t pollFlags() const { return mPollFlags; }
+  nsresult condition() const { return mCondition; }
+
+  // Both must be called on the transport thread. The epoll backend does not
+  // look at every handler on each wakeup, only at those that went through
+  // these, so handlers use them instead of setting PR_POLL_WRITE or a
+  // failed mCondition themselves.
+  void watchForWrite();
+  void close(nsresult aCondition);
+
+  // The epoll backend's record of the socket while it is attached.
+  transport::Entry* mEntry;
+};
+
+// Drives the signaling sockets either through media::SocketTransportService
+// or, on Linux, through a dedicated edge triggered epoll thread. Handlers
+// are called the same way by both, so they must read and write until the
+// socket would block.
+namespace transport {
+
+// Switches to the epoll backend. Must be called before anything is
+// attached. Returns false when it is not available.
+bool UseEpoll();
+void Shutdown();
+
+// Watches aSocket and calls aHandler on the transport thread.
+void Attach(PRFileDesc* aSocket, SignalHandler* aHandler);
+// Runs aRunnable on the transport thread.
+void Dispatch(media::Runnable* aRunnable);
+
+} // namespace transport
+
+#endif // #define TRANSPORT_DOT_H
@@ -0,0 +1,212 @@
+#include "websocket.h"
+
+#include <string.h>
+#include <strings.h>
+
+#include "pk11pub.h"
+#include "plbase64.h"
+
+namespace websocket {
+
+static const char sAcceptGUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+static const size_t sSHA1Length = 20;
+// Anything bigger than this is not a signaling client.
+static const size_t sMaxHandshake = 8192;
+
+bool
+IsUpgrade(const char* aData, size_t aLength)
+{
+  return (aLength >= 4) && (memcmp(aData, "GET ", 4) == 0);
+}
+
+// Finds aName in the header block and returns its trimmed value.
+static bool
+HeaderValue(const char* aData, size_t aLength, const char* aName, std::string& aValue)
+{
+  const size_t nameLength = strlen(aName);
+  const char* end = aData + aLength;
+  const char* line = aData;
+  while (line < end) {
+    const char* eol = (const char*)memchr(line, '\n', end - line);
+    if (!eol) {
+      eol = end;
+    }
+    if (((size_t)(eol - line) > nameLength) && (line[nameLength] == ':') && (strncasecmp(line, aName, nameLength) == 0)) {
+      const char* value = line + nameLength + 1;
+      const char* valueEnd = eol;
+      while ((value < valueEnd) && ((*value == ' ') || (*value == '\t'))) { value++; }
+      while ((valueEnd > value) && ((valueEnd[-1] == '\r') || (valueEnd[-1] == ' ') || (valueEnd[-1] == '\t'))) { valueEnd--; }
+      aValue.assign(value, valueEnd - value);
+      return true;
+    }
+    line = eol + 1;
+  }
+  return false;
+}
+
+// Case insensitive search for aToken in a comma separated header value.
+static bool
+HasToken(const std::string& aValue, const char* aToken)
+{
+  const size_t tokenLength = strlen(aToken);
+  size_t start = 0;
+  while (start <= aValue.length()) {
+    size_t end = aValue.find(',', start);
+    if (end == std::string::npos) {
+      end = aValue.length();
+    }
+    size_t first = start;
+    size_t last = end;
+    while ((first < last) && (aValue[first] == ' ')) { first++; }
+    while ((last > first) && (aValue[last - 1] == ' ')) { last--; }
+    if (((last - first) == tokenLength) && (strncasecmp(aValue.data() + first, aToken, tokenLength) == 0)) {
+      return true;
+    }
+    start = end + 1;
+  }
+  return false;
+}
+
+size_t
+Handshake(const char* aData, size_t aLength, std::string& aResponse, bool& aValid)
+{
+  aValid = false;
+  const char* end = nullptr;
+  for (size_t ix = 0; (ix + 4) <= aLength; ix++) {
+    if ((aData[ix] == '\r') && (memcmp(aData + ix, "\r\n\r\n", 4) == 0)) {
+      end = aData + ix + 4;
+      break;
+    }
+  }
+  if (!end) {
+    if (aLength < sMaxHandshake) {
+      return 0;
+    }
+    aResponse = "HTTP/1.1 431 Request Header Fields Too Large\r\nConnection: close\r\n\r\n";
+    return aLength;
+  }
+
+  const size_t used = end - aData;
+  std::string upgrade, connection, version, key;
+  if (!HeaderValue(aData, used, "Upgrade", upgrade) ||
+      !HeaderValue(aData, used, "Connection", connection) ||
+      !HeaderValue(aData, used, "Sec-WebSocket-Version", version) ||
+      !HeaderValue(aData, used, "Sec-WebSocket-Key", key) ||
+      !HasToken(upgrade, "websocket") ||
+      !HasToken(connection, "upgrade") ||
+      (version != "13") ||
+      key.empty()) {
+    aResponse = "HTTP/1.1 400 Bad Request\r\nSec-WebSocket-Version: 13\r\nConnection: close\r\n\r\n";
+    return used;
+  }
+
+  key += sAcceptGUID;
+  unsigned char digest[sSHA1Length];
+  if (PK11_HashBuf(SEC_OID_SHA1, digest, (const unsigned char*)key.data(), (PRInt32)key.length()) != SECSuccess) {
+    aResponse = "HTTP/1.1 500 Internal Server Error\r\nConnection: close\r\n\r\n";
+    return used;
+  }
+  char accept[((sSHA1Length + 2) / 3) * 4 + 1];
+  PL_Base64Encode((const char*)digest, sSHA1Length, accept);
+  accept[sizeof(accept) - 1] = '\0';
+
+  aResponse = "HTTP/1.1 101 Switching Protocols\r\n"
+              "Upgrade: websocket\r\n"
+              "Connection: Upgrade\r\n"
+              "Sec-WebSocket-Accept: ";
+  aResponse += accept;
+  aResponse += "\r\n\r\n";
+  aValid = true;
+  return used;
+}
+
+bool
+ParseHeader(const char* aData, size_t aLength, char aFirst, FrameHeader& aHeader)
+{
+  if (aLength < 2) {
+    return false;
+  }
+  const unsigned char* data = (const unsigned char*)aData;
+  const unsigned char first = (unsigned char)aFirst;
+  aHeader.fin = (first & 0x80) != 0;
+  aHeader.opcode = first & 0x0F;
+  aHeader.masked = (data[1] & 0x80) != 0;
+  aHeader.length = data[1] & 0x7F;
+  size_t size = 2;
+  if (aHeader.length == 126) {
+    size += 2;
+    if (aLength < size) {
+      return false;
+    }
+    aHeader.length = ((uint64_t)data[2] << 8) | data[3];
+  }
+  else if (aHeader.length == 127) {
+    size += 8;
+    if (aLength < size) {
+      return false;
+    }
+    aHeader.length = 0;
+    for (size_t ix = 2; ix < 10; ix++) {
+      aHeader.length = (aHeader.length << 8) | data[ix];
+    }
+  }
+  if (aHeader.masked) {
+    if (aLength < (size + 4)) {
+      return false;
+    }
+    memcpy(aHeader.mask, data + size, 4);
+    size += 4;
+  }
+  aHeader.size = size;
+  return true;
+}
+
+void
+Unmask(char* aData, size_t aLength, const uint8_t aMask[4], size_t aOffset)
+{
+  size_t ix = 0;
+  // Byte at a time up to a word boundary, then a word at a time.
+  while ((ix < aLength) && (((uintptr_t)(aData + ix) & (sizeof(uint32_t) - 1)) != 0)) {
+    aData[ix] ^= aMask[(aOffset + ix) & 3];
+    ix++;
+  }
+  uint8_t rotated[4];
+  for (size_t jx = 0; jx < 4; jx++) {
+    rotated[jx] = aMask[(aOffset + ix + jx) & 3];
+  }
+  uint32_t mask;
+  memcpy(&mask, rotated, sizeof(mask));
+  for (; (ix + sizeof(uint32_t)) <= aLength; ix += sizeof(uint32_t)) {
+    uint32_t word;
+    memcpy(&word, aData + ix, sizeof(word));
+    word ^= mask;
+    memcpy(aData + ix, &word, sizeof(word));
+  }
+  for (; ix < aLength; ix++) {
+    aData[ix] ^= aMask[(aOffset + ix) & 3];
+  }
+}
+
+size_t
+WriteHeader(char* aHeader, uint8_t aOpcode, size_t aLength)
+{
+  aHeader[0] = (char)(0x80 | aOpcode);
+  if (aLength < 126) {
+    aHeader[1] = (char)aLength;
+    return 2;
+  }
+  if (aLength <= 0xFFFF) {
+    aHeader[1] = 126;
+    aHeader[2] = (char)(aLength >> 8);
+    aHeader[3] = (char)aLength;
+    return 4;
+  }
+  aHeader[1] = 127;
+  const uint64_t length = aLength;
+  for (size_t ix = 0; ix < 8; ix++) {
+    aHeader[2 + ix] = (char)(length >> (56 - (ix * 8)));
+  }
+  return 10;
+}
+
+} // namespace websocket
@@ -0,0 +1,55 @@
+#ifndef WEBSOCKET_DOT_H
+#define WEBSOCKET_DOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// RFC 6455 pieces needed to carry signaling messages over a WebSocket.
+namespace websocket {
+
+enum Opcode {
+  OpContinuation = 0x0,
+  OpText = 0x1,
+  OpBinary = 0x2,
+  OpClose = 0x8,
+  OpPing = 0x9,
+  OpPong = 0xA
+};
+
+// Largest header a server writes: two bytes plus a 64 bit length.
+static const size_t sMaxServerHeader = 10;
+
+struct FrameHeader {
+  bool fin;
+  uint8_t opcode;
+  bool masked;
+  uint8_t mask[4];
+  uint64_t length;
+  // Bytes taken by the header itself, payload follows.
+  size_t size;
+};
+
+// Returns true when aLength bytes hold the request line of an upgrade.
+bool IsUpgrade(const char* aData, size_t aLength);
+
+// Parses a client opening handshake. Returns the number of bytes it used,
+// or zero while it is still incomplete. aResponse holds the reply, which is
+// a 400 when aValid comes back false.
+size_t Handshake(const char* aData, size_t aLength, std::string& aResponse, bool& aValid);
+
+// Reads a frame header. Returns false while aLength is too short to hold it.
+// aFirst replaces aData[0], which the framer may have overwritten.
+bool ParseHeader(const char* aData, size_t aLength, char aFirst, FrameHeader& aHeader);
+
+// Unmasks aLength payload bytes in place. aOffset is the position of aData
+// inside the frame payload.
+void Unmask(char* aData, size_t aLength, const uint8_t aMask[4], size_t aOffset);
+
+// Writes an unmasked, unfragmented server frame header into aHeader, which
+// must hold sMaxServerHeader bytes. Returns the header size.
+size_t WriteHeader(char* aHeader, uint8_t aOpcode, size_t aLength);
+
+} // namespace websocket
+
+#endif // #define WEBSOCKET_DOT_H
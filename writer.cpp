@@ -0,0 +1,221 @@
+#include "writer.h"
+
+#include <string.h>
+
+#include "prerror.h"
+
+typedef media::MutexAutoLock MutexAutoLock;
+
+SignalWriter::SignalWriter(const char* aTerminator, size_t aTerminatorSize) :
+  mMutex("SignalWriter.mMutex"),
+  mSocket(nullptr),
+  mTerminator(aTerminator),
+  mTerminatorSize(aTerminatorSize),
+  mMode(Framer::FrameDelimited),
+  mSent(0) {}
+
+void
+SignalWriter::setSocket(PRFileDesc* aSocket)
+{
+  MutexAutoLock lock(mMutex);
+  mSocket = aSocket;
+  mQueue.clear();
+  mSent = 0;
+}
+
+void
+SignalWriter::setMode(Framer::Mode aMode)
+{
+  MutexAutoLock lock(mMutex);
+  mMode = aMode;
+}
+
+SignalWriter::Result
+SignalWriter::send(const char* aData, size_t aLength, uint8_t aOpcode)
+{
+  MutexAutoLock lock(mMutex);
+  if (!mSocket) {
+    return Failed;
+  }
+
+  char header[websocket::sMaxServerHeader];
+  PRIOVec iov[2];
+  if (mMode != Framer::FrameDelimited) {
+    iov[0].iov_base = header;
+    iov[0].iov_len = writeHeader(header, aLength, aOpcode);
+    iov[1].iov_base = (char*)aData;
+    iov[1].iov_len = aLength;
+  }
+  else {
+    iov[0].iov_base = (char*)aData;
+    iov[0].iov_len = aLength;
+    iov[1].iov_base = (char*)mTerminator;
+    iov[1].iov_len = mTerminatorSize;
+  }
+  return writev(iov, 2);
+}
+
+SignalWriter::Result
+SignalWriter::write(const char* aData, size_t aLength)
+{
+  MutexAutoLock lock(mMutex);
+  if (!mSocket) {
+    return Failed;
+  }
+
+  PRIOVec iov[1];
+  iov[0].iov_base = (char*)aData;
+  iov[0].iov_len = aLength;
+  return writev(iov, 1);
+}
+
+void
+SignalWriter::beginMessage()
+{
+  mMessage.clear();
+  size_t available = 0;
+  if (mMessage.reserve(websocket::sMaxServerHeader, available)) {
+    mMessage.commit(websocket::sMaxServerHeader);
+  }
+}
+
+SignalWriter::Result
+SignalWriter::sendMessage(uint8_t aOpcode)
+{
+  MutexAutoLock lock(mMutex);
+  if (!mSocket || (mMessage.length() < websocket::sMaxServerHeader)) {
+    return Failed;
+  }
+
+  const size_t length = mMessage.length() - websocket::sMaxServerHeader;
+  size_t start = websocket::sMaxServerHeader;
+  if (mMode != Framer::FrameDelimited) {
+    // The header goes right in front of the message, in the room left by
+    // beginMessage().
+    char header[websocket::sMaxServerHeader];
+    const size_t size = writeHeader(header, length, aOpcode);
+    start -= size;
+    memcpy(mMessage.data() + start, header, size);
+  }
+  else {
+    size_t available = 0;
+    char* terminator = mMessage.reserve(mTerminatorSize, available);
+    if (!terminator) {
+      return Failed;
+    }
+    memcpy(terminator, mTerminator, mTerminatorSize);
+    mMessage.commit(mTerminatorSize);
+  }
+
+  PRIOVec iov[1];
+  iov[0].iov_base = mMessage.data() + start;
+  iov[0].iov_len = mMessage.length() - start;
+  return writev(iov, 1);
+}
+
+// Length prefix or WebSocket header for a message of aLength, none when
+// delimited. Must be called with mMutex held.
+size_t
+SignalWriter::writeHeader(char* aHeader, size_t aLength, uint8_t aOpcode)
+{
+  if (mMode == Framer::FramePrefixed) {
+    aHeader[0] = (char)(aLength >> 24);
+    aHeader[1] = (char)(aLength >> 16);
+    aHeader[2] = (char)(aLength >> 8);
+    aHeader[3] = (char)aLength;
+    return Framer::sPrefixSize;
+  }
+  if (mMode == Framer::FrameWebSocket) {
+    return websocket::WriteHeader(aHeader, aOpcode, aLength);
+  }
+  return 0;
+}
+
+// Must be called with mMutex held.
+SignalWriter::Result
+SignalWriter::writev(PRIOVec* aVector, int aCount)
+{
+  if (mQueue.length() > mSent) {
+    // Nothing of the message has gone out, so a message that does not fit
+    // is taken back out of the queue whole.
+    const size_t unsent = mQueue.length() - mSent;
+    for (int ix = 0; ix < aCount; ix++) {
+      if (!append(aVector[ix].iov_base, aVector[ix].iov_len)) {
+        mQueue.truncate(mSent + unsent);
+        return Failed;
+      }
+    }
+    return Queued;
+  }
+
+  PRInt32 written = PR_Writev(mSocket, aVector, aCount, PR_INTERVAL_NO_WAIT);
+  if (written < 0) {
+    if (PR_GetError() != PR_WOULD_BLOCK_ERROR) {
+      return Failed;
+    }
+    written = 0;
+  }
+
+  size_t skip = (size_t)written;
+  bool queued = false;
+  for (int ix = 0; ix < aCount; ix++) {
+    if (skip >= (size_t)aVector[ix].iov_len) {
+      skip -= aVector[ix].iov_len;
+      continue;
+    }
+    // Part of the message is already on the wire, so the stream cannot
+    // go on without the rest.
+    if (!append(aVector[ix].iov_base + skip, aVector[ix].iov_len - skip)) {
+      return Failed;
+    }
+    skip = 0;
+    queued = true;
+  }
+  return (queued ? StartPolling : Sent);
+}
+
+bool
+SignalWriter::flush()
+{
+  MutexAutoLock lock(mMutex);
+  while (mSocket && (mQueue.length() > mSent)) {
+    PRInt32 written = PR_Send(mSocket, mQueue.data() + mSent, (PRInt32)(mQueue.length() - mSent), 0, PR_INTERVAL_NO_WAIT);
+    if (written <= 0) {
+      if ((written < 0) && (PR_GetError() == PR_WOULD_BLOCK_ERROR)) {
+        return true;
+      }
+      // The read side notices the closed connection and detaches the socket.
+      break;
+    }
+    mSent += written;
+  }
+  mQueue.clear();
+  mSent = 0;
+  return false;
+}
+
+// Queues aData behind whatever is still unsent. Fails rather than let a
+// peer that stopped reading grow the queue without bound. Must be called
+// with mMutex held.
+bool
+SignalWriter::append(const char* aData, size_t aLength)
+{
+  const size_t unsent = mQueue.length() - mSent;
+  if ((unsent + aLength) > Framer::sMaximumBuffer) {
+    return false;
+  }
+  if (mSent && ((mQueue.length() + aLength) > Framer::sMaximumBuffer)) {
+    // Move what is left to the front rather than grow past the limit.
+    memmove(mQueue.data(), mQueue.data() + mSent, unsent);
+    mQueue.truncate(unsent);
+    mSent = 0;
+  }
+  size_t available = 0;
+  char* buffer = mQueue.reserve(aLength, available);
+  if (!buffer) {
+    return false;
+  }
+  memcpy(buffer, aData, aLength);
+  mQueue.commit(aLength);
+  return true;
+}
@@ -0,0 +1,66 @@
+#ifndef WRITER_DOT_H
+#define WRITER_DOT_H
+
+#include "MediaMutex.h"
+#include "MediaRefCount.h"
+
+#include "prio.h"
+
+#include "framer.h"
+#include "websocket.h"
+
+// Outbound side of a signaling connection. Each message and its terminator,
+// or its length prefix or WebSocket header once the connection switches
+// framing, go out in a single non-blocking PR_Writev. Whatever the socket
+// will not take right away is queued and flushed from the socket thread once
+// the socket is writable, so the caller never blocks.
+class SignalWriter {
+MEDIA_REF_COUNT_INLINE
+public:
+  enum Result {
+    Sent,        // Everything was written.
+    Queued,      // Queued behind earlier data, write polling already active.
+    StartPolling,// Queued, caller must enable PR_POLL_WRITE on the socket.
+    Failed       // Socket error, or more than Framer::sMaximumBuffer would be
+                 // queued. Caller must close the connection.
+  };
+
+  SignalWriter(const char* aTerminator, size_t aTerminatorSize);
+
+  void setSocket(PRFileDesc* aSocket);
+  void setMode(Framer::Mode aMode);
+
+  // aOpcode is only used in Framer::FrameWebSocket mode.
+  Result send(const char* aData, size_t aLength, uint8_t aOpcode = websocket::OpText);
+  // Writes aData as is, without any framing.
+  Result write(const char* aData, size_t aLength);
+
+  // Messages may also be built straight into the writer's message buffer.
+  // beginMessage() empties it, leaving room in front for a header, and
+  // sendMessage() frames what was appended since, adding the terminator or
+  // header in place, and sends it with one write. Only the thread sending
+  // messages may touch the buffer.
+  FrameBuffer& message() { return mMessage; }
+  void beginMessage();
+  Result sendMessage(uint8_t aOpcode = websocket::OpText);
+
+  // Called from the socket thread when it is writable. Returns true while
+  // data is still queued.
+  bool flush();
+
+protected:
+  size_t writeHeader(char* aHeader, size_t aLength, uint8_t aOpcode);
+  Result writev(PRIOVec* aVector, int aCount);
+  bool append(const char* aData, size_t aLength);
+
+  media::Mutex mMutex;
+  PRFileDesc* mSocket;
+  const char* mTerminator;
+  const size_t mTerminatorSize;
+  Framer::Mode mMode;
+  FrameBuffer mQueue;
+  size_t mSent;
+  FrameBuffer mMessage;
+};
+
+#endif // #define WRITER_DOT_H